@@ -1,2 +1,4 @@
 clear
-clang++ -std=c++20 ./src/main.cpp -o ./build/ciktor
+# The checksum of the sources names the build in the program cache, see buildIdentity().
+build=$(cat ./src/*.h ./src/*.cpp | cksum | cut -d ' ' -f 1)
+clang++ -std=c++20 -O2 -pthread -DCIKTOR_BUILD="\"$build\"" ./src/main.cpp -o ./build/ciktor
@@ -1,27 +1,115 @@
 #include "common.h"
 
+
+constexpr std::string_view keywordNames[] = {
+	"if", "else", "for", "func", "print", "throw", "return", "void",
+	"array", "bool", "int", "double", "string", "input", "exit", "true", "false", "pure", "push", "pop", "reserve",
+	"readAll", "readLines", "pmap",
+};
+
+// Perfect hash over keywordNames; the static_assert below rejects any collision.
+constexpr size_t keywordHash(std::string_view word) {
+	return (word.size() + word.front() * 8 + word.back()) % 64;
+}
+
+constexpr auto keywordSlots = [] {
+	std::array<int8_t, 64> slots{};
+	slots.fill(-1);
+	for (size_t k = 0; k < std::size(keywordNames); k++)
+		slots[keywordHash(keywordNames[k])] = int8_t(k);
+	return slots;
+}();
+
+static_assert([] {
+	for (size_t k = 0; k < std::size(keywordNames); k++)
+		if (keywordSlots[keywordHash(keywordNames[k])] != int8_t(k))
+			return false;
+	return true;
+}(), "keywordHash is not perfect over keywordNames");
+
+// Gives every distinct identifier a dense id, so later passes index tables instead of hashing names.
+struct SymbolTable {
+	std::unordered_map<std::string_view, int> ids;
+	std::vector<std::string_view> names;
+
+	Symbol intern(std::string_view name) {
+		auto [it, inserted] = ids.try_emplace(name, int(names.size()));
+		if (inserted)
+			names.push_back(name);
+		return Symbol{it->second};
+	}
+	size_t size() const {
+		return names.size();
+	}
+};
+
+// A read-only memory mapping of a file, such as a source file whose tokens and symbols point straight into it.
+class MappedFile {
+	char const* data = nullptr;
+	size_t length = 0;
+
+public:
+	MappedFile() = default;
+	MappedFile(const char* filePath) {
+		int fd = open(filePath, O_RDONLY);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) < 0) {
+			if (fd >= 0)
+				close(fd);
+			throw ScriptError(ScriptError::Kind::Error, -1, "could not open the file");
+		}
+		length = size_t(info.st_size);
+		if (length > 0) {
+			void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				close(fd);
+				throw ScriptError(ScriptError::Kind::Error, -1, "could not read the file");
+			}
+			madvise(mapping, length, MADV_SEQUENTIAL);
+			data = static_cast<char const*>(mapping);
+		}
+		close(fd);
+	}
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+	~MappedFile() {
+		if (data != nullptr)
+			munmap(const_cast<char*>(data), length);
+	}
+
+	char const* begin() const { return data; }
+	size_t size() const { return length; }
+};
+
+class BuiltinRegistry;
+
 class Lexer {
-	std::string file;
+	char const* file;
+	size_t size;
 	size_t i = 0;
 	int line = 0;
 
+	// The mapping has no terminating NUL, so reads past the end yield one.
+	char at(size_t index) const {
+		return index < size ? file[index] : '\0';
+	}
+
 public:
 	Token token;
 	int tokenLine;
+	SymbolTable symbols;
+	Arena& arena;
+	BuiltinRegistry const& builtins; // what the parser binds calls to
 
-	Lexer(const char* filePath)
+	// Lexes source text the caller keeps alive as long as the lexer and the parsed program.
+	Lexer(std::string_view text, Arena& arena, BuiltinRegistry const& builtins) :
+		file(text.data()), size(text.size()), arena(arena), builtins(builtins)
 	{
-		std::ifstream input_file(filePath);
-		input_file.exceptions(std::ifstream::failbit);
-		std::stringstream buffer;
-		buffer << input_file.rdbuf();
-		file = buffer.str();
 		next();
 	}
 
 	[[noreturn]] void error(char const* message) {
-		std::cerr << tokenLine + 1 << ": " << makeStringRed(message) << '\n';
-		std::exit(1);
+		throw ScriptError(ScriptError::Kind::Error, tokenLine, message);
 	}
 	void expect(int code) {
 		if (auto n = std::get_if<int>(&token)) {
@@ -33,34 +121,45 @@ public:
 		error("Unexpected token");
 	}
 	void next() {
-		while (file[i] == ' ' || file[i] == '\t')
+		while (at(i) == ' ' || at(i) == '\t')
 			i++;
 		tokenLine = line;
 
-		if (std::isalpha(file[i])) {
+		if (std::isalpha(at(i))) {
 			size_t oldI = i;
 			do {
 				i++;
-			} while (std::isalnum(file[i]) || file[i] == '_');
-			token = std::string_view(&file[oldI], i - oldI);
+			} while (std::isalnum(at(i)) || at(i) == '_');
+			std::string_view word(file + oldI, i - oldI);
+			int8_t keyword = keywordSlots[keywordHash(word)];
+			if (keyword >= 0 && keywordNames[keyword] == word)
+				token = Keyword(keyword);
+			else
+				token = symbols.intern(word);
 		}
-		else if (std::isdigit(file[i])) {
-			double n = 0;
+		else if (std::isdigit(at(i))) {
+			int64_t n = 0;
+			double d = 0;
+			bool overflow = false;
 			do {
-				n = n * 10 + file[i] - '0';
+				d = d * 10 + at(i) - '0';
+				overflow = overflow || __builtin_mul_overflow(n, 10, &n) || __builtin_add_overflow(n, at(i) - '0', &n);
 				i++;
-			} while (std::isdigit(file[i]));
-			token = n;
+			} while (std::isdigit(at(i)));
+			if (overflow)
+				token = d;
+			else
+				token = n;
 		}
 		else
-			switch (file[i]) {
+			switch (at(i)) {
 			case '\n':
 				i++;
 				line++;
 				token = Token{'\n'};
 				break;
 			case '/':
-				if(file[++i] == '/') {
+				if(at(++i) == '/') {
 					token = ExtendedToken::SlashSlash;
 					i++;
 				} else {
@@ -68,7 +167,7 @@ public:
 				}
 				break;
 			case '<':
-				if(file[++i] == '='){
+				if(at(++i) == '='){
 					token = ExtendedToken::LessEquals;
 					i++;
 				}else{
@@ -76,7 +175,7 @@ public:
 				}
 				break;
 			case '>':
-				if(file[++i] == '='){
+				if(at(++i) == '='){
 					token = ExtendedToken::GreaterEquals;
 					i++;
 				}else{
@@ -85,7 +184,7 @@ public:
 				break;
 			
 			case '!':
-				if(file[++i] == '='){
+				if(at(++i) == '='){
 					token = ExtendedToken::NotEquals;
 					i++;
 				}else{
@@ -93,7 +192,7 @@ public:
 				}
 				break;
 			case '|':
-				if(file[++i] == '|'){
+				if(at(++i) == '|'){
 					token = ExtendedToken::OrOr;
 					i++;
 				}else{
@@ -101,7 +200,7 @@ public:
 				}
 				break;
 			case '&':
-				if(file[++i] == '&'){
+				if(at(++i) == '&'){
 					token = ExtendedToken::AndAnd;
 					i++;
 				} else {
@@ -121,10 +220,10 @@ public:
 			case '*':
 			case ',':
 			case '%':
-				token = file[i++];
+				token = at(i++);
 				break;
 			case '=':
-				if (file[++i] == '=') {
+				if (at(++i) == '=') {
 					token = ExtendedToken::EqualsEquals;
 					i++;
 				} else {
@@ -132,7 +231,7 @@ public:
 				}
 				break;
 			case '-':
-				if (file[++i] == '>') {
+				if (at(++i) == '>') {
 					token = ExtendedToken::RightArrow;
 					i++;
 				} else {
@@ -140,7 +239,7 @@ public:
 				}
 				break;
 			case '#':
-				while (file[i] != '\n' && file[i] != 0) {
+				while (at(i) != '\n' && at(i) != 0) {
 					i++;
 				}
 				next();
@@ -148,12 +247,12 @@ public:
 			case '"': {
 				i++;
 				size_t startI = i;
-				while (file[i] != '"') {
-					if (file[i] == 0) error("expecting a closing '\"'");
-					if (file[i] == '\n')line++;
+				while (at(i) != '"') {
+					if (at(i) == 0) error("expecting a closing '\"'");
+					if (at(i) == '\n')line++;
 					i++;
 				}
-				token = file.substr(startI, i++ - startI);
+				token = std::string_view(file + startI, i++ - startI);
 			} break;
 			case 0:
 				token = 0;
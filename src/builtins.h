@@ -0,0 +1,124 @@
+#include "kernels.h"
+#include <functional>
+
+
+using NativeFunction = std::function<Value(int line, std::span<Value> args)>;
+
+// A function implemented in C++. It gets its arguments in place on the value stack, already
+// conforming to params, and must return a value of returnType.
+struct Builtin {
+	std::string name;
+	std::vector<Type> params;
+	Type returnType;
+	NativeFunction call;
+	bool pure = true; // false for functions with effects, which pure script functions can't call
+};
+
+// The native functions a program can call: the standard ones below, and whatever its host adds.
+// A call binds to the builtins of its name only if no script function has that name, and takes
+// the first overload whose parameters its arguments conform to. A host that calls into C++ makes
+// a registry of its own, adds its functions and compiles its programs with it, e.g.
+//
+//     BuiltinRegistry natives;
+//     natives.add({"clamp", {Type::Double, Type::Double, Type::Double}, Type::Double,
+//         [](int, std::span<Value> args) { return std::clamp(args[0].asDouble(), args[1].asDouble(), args[2].asDouble()); }});
+//     auto program = Program::fromText(source, Engine::VM, nullptr, natives);
+//
+// Registries are independent of each other, so hosts (or parts of one) with different natives
+// don't see each other's. Programs point into the registry they were compiled with, so it must
+// outlive them, and it is sealed once the parser has looked a name up in it.
+class BuiltinRegistry {
+	std::vector<Builtin> entries;
+	mutable std::atomic<bool> sealed = false; // programs may be parsed on several threads at once
+
+public:
+	BuiltinRegistry();
+	BuiltinRegistry(BuiltinRegistry const&) = delete;
+	BuiltinRegistry& operator=(BuiltinRegistry const&) = delete;
+
+	// Overloads of one name stay adjacent, in the order they were added. Throws std::logic_error
+	// once the registry is sealed, in release builds too: inserting would move the entries that
+	// parsed calls point to and shift the indices compiled and cached bytecode refers to.
+	void add(Builtin builtin) {
+		if (sealed.load(std::memory_order_relaxed))
+			throw std::logic_error("builtins must be added before any script is parsed");
+		auto last = std::find_if(entries.rbegin(), entries.rend(), [&](auto& b) { return b.name == builtin.name; });
+		entries.insert(last == entries.rend() ? entries.end() : last.base(), std::move(builtin));
+	}
+
+	// The overloads starting at the entry with the given index.
+	std::span<Builtin const> from(size_t index) const {
+		auto first = entries.begin() + index;
+		return {first, std::find_if(first, entries.end(), [&](auto& b) { return b.name != first->name; })};
+	}
+
+	std::span<Builtin const> named(std::string_view name) const {
+		sealed.store(true, std::memory_order_relaxed);
+		auto first = std::ranges::find(entries, name, &Builtin::name);
+		return first == entries.end() ? std::span<Builtin const>() : from(size_t(first - entries.begin()));
+	}
+
+	std::span<Builtin const> all() const {
+		return entries;
+	}
+
+	size_t index(Builtin const& builtin) const {
+		return size_t(&builtin - entries.data());
+	}
+};
+
+// Ints come before doubles in each group, so int arguments keep their type.
+inline BuiltinRegistry::BuiltinRegistry() : entries({
+	{"sum", {Type::IntArray}, Type::Int, intSum},
+	{"sum", {Type::DoubleArray}, Type::Double, doubleSum},
+	{"min", {Type::IntArray}, Type::Int, intExtreme<false>},
+	{"min", {Type::DoubleArray}, Type::Double, doubleExtreme<false>},
+	{"max", {Type::IntArray}, Type::Int, intExtreme<true>},
+	{"max", {Type::DoubleArray}, Type::Double, doubleExtreme<true>},
+	{"dot", {Type::IntArray, Type::IntArray}, Type::Int, intDot},
+	{"dot", {Type::DoubleArray, Type::DoubleArray}, Type::Double, doubleDot},
+	{"scale", {Type::IntArray, Type::Int}, Type::IntArray, intScale},
+	{"scale", {Type::DoubleArray, Type::Double}, Type::DoubleArray, doubleScale},
+	{"indexOf", {Type::IntArray, Type::Int}, Type::Int, intIndexOf},
+	{"indexOf", {Type::DoubleArray, Type::Double}, Type::Int, doubleIndexOf},
+	{"indexOf", {Type::StringArray, Type::String}, Type::Int, stringIndexOf},
+	{"sort", {Type::IntArray}, Type::IntArray, intSort},
+	{"sort", {Type::DoubleArray}, Type::DoubleArray, doubleSort},
+	{"sort", {Type::StringArray}, Type::StringArray, stringSort},
+}) {}
+
+// The standard builtins alone, for programs compiled without a registry of their own. Nothing can
+// be added to it, so sharing it between every such program is safe.
+inline BuiltinRegistry const& standardBuiltins() {
+	static BuiltinRegistry const registry;
+	return registry;
+}
+
+// Runs the first overload the arguments conform to, converting them as for a script function.
+// Checked arguments were matched to the first overload by the type checker.
+static Value callBuiltin(int line, std::span<Builtin const> overloads, bool checked, std::span<Value> args) {
+	auto run = [&](Builtin const& builtin) {
+		Value result;
+		try {
+			result = builtin.call(line, args);
+		}
+		catch (...) {
+			rethrowAsScriptError(line); // the embedding program's natives may throw anything
+		}
+		if (!conforms(result, builtin.returnType))
+			runtimeError(line, "Type missmatch. Return type must match function type");
+		return result;
+	};
+	if (checked)
+		return run(overloads[0]);
+	for (auto& builtin : overloads) {
+		if (builtin.params.size() != args.size())
+			continue;
+		bool conforming = true;
+		for (size_t i = 0; i < args.size() && conforming; i++)
+			conforming = conforms(args[i], builtin.params[i]);
+		if (conforming)
+			return run(builtin);
+	}
+	runtimeError(line, "wrong type of argument");
+}
@@ -0,0 +1,493 @@
+#include "folder.h"
+
+
+// The operators the type checker specializes for ints and for doubles, each of which has an
+// opcode per type: AddInt, AddDouble and so on.
+#define TYPED_OPERATORS(Y, X) \
+	Y(X, Add) Y(X, Subtract) Y(X, Multiply) Y(X, Divide) Y(X, DivideRemainder) Y(X, DivideWhole) \
+	Y(X, Equal) Y(X, NotEquals) Y(X, Less) Y(X, LessEquals) Y(X, Greater) Y(X, GreaterEquals)
+#define INT_OPCODE(X, op) X(op##Int)
+#define DOUBLE_OPCODE(X, op) X(op##Double)
+
+#define OPCODES(X) \
+	X(Constant)     /* push constants[a] */ \
+	X(LoadLocal)    /* push slot a of the current frame */ \
+	X(LoadGlobal)   /* push global slot a */ \
+	X(StoreLocal)   /* pop into slot a of the current frame; unless b & 1, the value must have type b >> 1 */ \
+	X(StoreGlobal)  /* pop into global slot a, b as for StoreLocal */ \
+	X(IncrementLocalInt)     /* add the int16 b to the int in local slot a */ \
+	X(IncrementGlobalInt)    /* the same for global slot a */ \
+	X(IncrementLocalDouble)  /* the same for a double */ \
+	X(IncrementGlobalDouble) \
+	X(Pop) \
+	X(PopVoid)      /* pop a statement value, which must be void */ \
+	X(Binary)       /* pop right and left, push left <b> right */ \
+	TYPED_OPERATORS(INT_OPCODE, X)    /* Binary on operands the type checker proved to be ints */ \
+	TYPED_OPERATORS(DOUBLE_OPCODE, X) /* the same for doubles */ \
+	X(AndBool)      /* the same for && on bools */ \
+	X(OrBool) \
+	X(Index)        /* pop an index and an array or string, push the element */ \
+	X(IndexLocal)   /* superinstruction for LoadLocal + Index: replace the index on top with the element of slot a */ \
+	X(IndexGlobal)  /* the same for global slot a */ \
+	X(CompareJump)  /* superinstruction for Binary + a conditional jump: jump to a if left <b & 0xFF> right is b >> 8 */ \
+	X(CompareJumpInt)    /* the same on proven ints */ \
+	X(CompareJumpDouble) /* the same on proven doubles */ \
+	X(Not) \
+	X(Size) \
+	X(MakeArray)    /* pop a values into a new array with element type b */ \
+	X(Input)        /* push what InputMode(a) reads from stdin */ \
+	X(Exit) \
+	X(Print) \
+	X(PrintNewline) \
+	X(Throw) \
+	X(Jump)         /* jump to a */ \
+	X(JumpIfFalse)  /* pop a condition and jump to a if false, b selects the error message */ \
+	X(JumpIfTrue)   /* the same, jumping if true */ \
+	X(DefineFunc)   /* register functions[a] in the context */ \
+	X(UpdateLocal)  /* pop an operand and b >> 2 indices, apply ArrayOperation(b & 3) to local slot a, push the result */ \
+	X(UpdateGlobal) /* the same for global slot a */ \
+	X(AppendLocal)  /* pop a value and append it to the string in local slot a */ \
+	X(AppendGlobal) /* the same for global slot a */ \
+	X(Call)         /* call the function named by symbol a with b arguments */ \
+	X(CallDirect)   /* call the linked functions[a], b is set if the argument types are already checked */ \
+	X(TailCall)     /* replace the current frame with a call of functions[a], b as for CallDirect */ \
+	X(CallBuiltin)  /* call builtins[a] with b >> 2 arguments, b & 1 as argsChecked; unless b & 2, try the overloads after it too */ \
+	X(ParallelMap)  /* pop an array, push functions[a] applied to every element; b is the result's element type << 1 | elements checked */ \
+	X(Return) \
+	X(ReturnVoid)   /* fell off the end of a function body */ \
+	X(Halt)
+
+enum class OpCode : uint8_t {
+#define X(name) name,
+	OPCODES(X)
+#undef X
+};
+
+struct Instruction {
+	OpCode op;
+	uint16_t b;
+	int32_t a;
+};
+
+struct FuncProto {
+	struct FuncDeclaration* decl;
+	int entry;
+};
+
+struct Chunk {
+	std::vector<Instruction> code;
+	std::vector<int> lines;
+	std::vector<Value> constants;
+	std::vector<FuncProto> functions;
+	int halt = 0; // the program's Halt, where functions run on their own return to
+	int depth = 0; // the most operands any frame holds at once, see measureDepth()
+	BuiltinRegistry const* builtins = nullptr; // what CallBuiltin indexes
+};
+
+// How many values the instruction leaves on the stack in place of those it takes. Instructions
+// that end the frame or the program count as if execution went on past them, like expressions.
+static int stackEffect(Chunk const& chunk, Instruction const& instruction) {
+	switch (instruction.op) {
+	case OpCode::Constant:
+	case OpCode::LoadLocal:
+	case OpCode::LoadGlobal:
+	case OpCode::Input:
+	case OpCode::Exit:
+		return 1;
+	case OpCode::StoreLocal:
+	case OpCode::StoreGlobal:
+	case OpCode::Pop:
+	case OpCode::PopVoid:
+	case OpCode::Binary:
+#define X(name) case OpCode::name:
+	TYPED_OPERATORS(INT_OPCODE, X)
+	TYPED_OPERATORS(DOUBLE_OPCODE, X)
+#undef X
+	case OpCode::AndBool:
+	case OpCode::OrBool:
+	case OpCode::Index:
+	case OpCode::Print:
+	case OpCode::Throw:
+	case OpCode::JumpIfFalse:
+	case OpCode::JumpIfTrue:
+	case OpCode::AppendLocal:
+	case OpCode::AppendGlobal:
+	case OpCode::Return:
+		return -1;
+	case OpCode::CompareJump:
+	case OpCode::CompareJumpInt:
+	case OpCode::CompareJumpDouble:
+		return -2;
+	case OpCode::MakeArray:
+		return 1 - instruction.a;
+	case OpCode::UpdateLocal:
+	case OpCode::UpdateGlobal:
+		return -(instruction.b >> 2);
+	case OpCode::Call:
+		return 1 - instruction.b;
+	case OpCode::CallDirect:
+		return 1 - int(chunk.functions[instruction.a].decl->params.size());
+	case OpCode::TailCall:
+		return -int(chunk.functions[instruction.a].decl->params.size());
+	case OpCode::CallBuiltin:
+		return 1 - (instruction.b >> 2);
+	default:
+		return 0;
+	}
+}
+
+// Every statement leaves the stack as it found it, so adding up the effects in code order gives,
+// at each instruction, at least the operands its frame holds there: a function body compiled
+// inside another statement starts from that statement's depth instead of none. Calls make sure
+// the stack has room for this many above each new frame.
+static void measureDepth(Chunk& chunk) {
+	int depth = 0;
+	chunk.depth = 0;
+	for (auto& instruction : chunk.code) {
+		depth += stackEffect(chunk, instruction);
+		chunk.depth = std::max(chunk.depth, depth);
+	}
+}
+
+static char const* const conditionErrors[] = {
+	"THE GIVEN CONDITION ISN'T A BOOLEAN",
+	"the condition must be a boolean",
+};
+
+struct Compiler {
+	Chunk chunk;
+	std::unordered_map<FuncDeclaration*, int> protos;
+
+	Compiler(BuiltinRegistry const& builtins) {
+		chunk.builtins = &builtins;
+	}
+
+	int emit(OpCode op, int line, int32_t a = 0, uint16_t b = 0) {
+		chunk.code.push_back(Instruction{op, b, a});
+		chunk.lines.push_back(line);
+		return int(chunk.code.size()) - 1;
+	}
+	void emitConstant(Value val, int line) {
+		chunk.constants.push_back(std::move(val));
+		emit(OpCode::Constant, line, int(chunk.constants.size()) - 1);
+	}
+	void patch(int jump) {
+		chunk.code[jump].a = int(chunk.code.size());
+	}
+
+	void compileStatements(std::span<AST*> statements, bool checkVoid) {
+		for (auto& statement : statements)
+			statement->compileStatement(*this, checkVoid);
+	}
+
+	// The index of the function's entry in chunk.functions, added on first use by a call or its declaration.
+	int proto(FuncDeclaration* decl) {
+		auto [it, added] = protos.try_emplace(decl, int(chunk.functions.size()));
+		if (added)
+			chunk.functions.push_back(FuncProto{decl, -1});
+		return it->second;
+	}
+
+	void compileBody(int index) {
+		auto decl = chunk.functions[index].decl;
+		chunk.functions[index].entry = int(chunk.code.size());
+		compileStatements(decl->body, true);
+		emit(OpCode::ReturnVoid, decl->line);
+	}
+
+	// Linked calls may reach functions whose declaration was folded away, so bodies no declaration
+	// compiled are appended after the program.
+	void compileProgram(std::span<AST*> statements, int endLine) {
+		compileStatements(statements, false);
+		chunk.halt = emit(OpCode::Halt, endLine);
+		for (int i = 0; i < int(chunk.functions.size()); i++)
+			if (chunk.functions[i].entry < 0)
+				compileBody(i);
+		measureDepth(chunk);
+	}
+
+	// Emits both operands and returns the type they were proven to have, if any. An int literal
+	// beside a double, as folding a constant subexpression leaves, is emitted as a double.
+	Type compileOperands(BinaryExpr& binary) {
+		auto literal = dynamic_cast<IntExpr*>(binary.left);
+		if (literal == nullptr)
+			literal = dynamic_cast<IntExpr*>(binary.right);
+		bool promoting = binary.promoted && literal != nullptr;
+		for (auto operand : {binary.left, binary.right}) {
+			if (promoting && operand == literal)
+				emitConstant(double(literal->val), literal->line);
+			else
+				operand->compile(*this);
+		}
+		return promoting ? Type::Double : binary.operands;
+	}
+
+	// Emits the condition and a jump taken when it is jumpIf, to be patched, fusing comparisons
+	// into one instruction.
+	int compileCondition(AST& condition, uint16_t message, bool jumpIf) {
+		if (auto binary = dynamic_cast<BinaryExpr*>(&condition)) {
+			switch (binary->op) {
+			case BinaryOperator::Equal:
+			case BinaryOperator::NotEquals:
+			case BinaryOperator::Less:
+			case BinaryOperator::LessEquals:
+			case BinaryOperator::Greater:
+			case BinaryOperator::GreaterEquals: {
+				auto operands = compileOperands(*binary);
+				auto op = operands == Type::Int ? OpCode::CompareJumpInt :
+					operands == Type::Double ? OpCode::CompareJumpDouble : OpCode::CompareJump;
+				return emit(op, binary->line, 0, uint16_t(int(binary->op) | jumpIf << 8));
+			}
+			default:
+				break;
+			}
+		}
+		condition.compile(*this);
+		return emit(jumpIf ? OpCode::JumpIfTrue : OpCode::JumpIfFalse, condition.line, 0, message);
+	}
+};
+
+// The opcode for a binary operation on operands of the proven type (Void if none).
+static OpCode binaryOpCode(BinaryOperator op, Type operands) {
+	if (operands == Type::Bool && op == BinaryOperator::AndAnd)
+		return OpCode::AndBool;
+	if (operands == Type::Bool && op == BinaryOperator::OrOr)
+		return OpCode::OrBool;
+	if (op == BinaryOperator::Index)
+		return OpCode::Index;
+	if (operands != Type::Int && operands != Type::Double)
+		return OpCode::Binary;
+	switch (op) {
+#define Y(X, name) case BinaryOperator::name: return operands == Type::Int ? OpCode::name##Int : OpCode::name##Double;
+	TYPED_OPERATORS(Y, )
+#undef Y
+	default:
+		return OpCode::Binary;
+	}
+}
+
+inline void AST::compileStatement(Compiler& c, bool checkVoid) {
+	compile(c);
+	c.emit(checkVoid ? OpCode::PopVoid : OpCode::Pop, line);
+}
+
+inline void ArrayExpr::compile(Compiler& c) {
+	for (auto& element : elements)
+		element->compile(c);
+	c.emit(OpCode::MakeArray, line, int(elements.size()), uint16_t(elementType));
+}
+
+inline void StringExpr::compile(Compiler& c) {
+	c.emitConstant(val, line);
+}
+
+inline void VariableExpr::compile(Compiler& c) {
+	c.emit(global ? OpCode::LoadGlobal : OpCode::LoadLocal, line, slot);
+}
+
+inline void IntExpr::compile(Compiler& c) {
+	c.emitConstant(val, line);
+}
+
+inline void NumberExpr::compile(Compiler& c) {
+	c.emitConstant(val, line);
+}
+
+inline void BoolExpr::compile(Compiler& c) {
+	c.emitConstant(val, line);
+}
+
+inline void NotExpr::compile(Compiler& c) {
+	operand->compile(c);
+	c.emit(OpCode::Not, line);
+}
+
+inline void InputExpr::compile(Compiler& c) {
+	c.emit(OpCode::Input, line, int(mode));
+}
+
+inline void exitExpr::compile(Compiler& c) {
+	c.emit(OpCode::Exit, line);
+}
+
+// Indexing a variable reads the element out of its slot, without a copy of the array on the
+// stack. The index is evaluated first, so only one that can neither fail nor have an effect, other
+// than being a variable not declared yet, which fails with the same error, is fused.
+inline void BinaryExpr::compile(Compiler& c) {
+	auto variable = dynamic_cast<VariableExpr*>(left);
+	bool plainIndex = dynamic_cast<VariableExpr*>(right) || dynamic_cast<IntExpr*>(right) || dynamic_cast<NumberExpr*>(right);
+	if (op == BinaryOperator::Index && variable != nullptr && plainIndex) {
+		right->compile(c);
+		c.emit(variable->global ? OpCode::IndexGlobal : OpCode::IndexLocal, line, variable->slot);
+		return;
+	}
+	auto types = c.compileOperands(*this);
+	c.emit(binaryOpCode(op, types), line, 0, uint16_t(op));
+}
+
+inline void PrintExpr::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void PrintExpr::compileStatement(Compiler& c, bool) {
+	if (printee == nullptr) {
+		c.emit(OpCode::PrintNewline, line);
+		return;
+	}
+	printee->compile(c);
+	c.emit(OpCode::Print, line);
+}
+
+inline void ErrorExpr::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void ErrorExpr::compileStatement(Compiler& c, bool) {
+	error->compile(c);
+	c.emit(OpCode::Throw, line);
+}
+
+inline void ArraySizeExpr::compile(Compiler& c) {
+	arr->compile(c);
+	c.emit(OpCode::Size, line);
+}
+
+inline void FuncCallExpression::compile(Compiler& c) {
+	for (auto& arg : args)
+		arg->compile(c);
+	if (!builtins.empty())
+		c.emit(OpCode::CallBuiltin, line, int(c.chunk.builtins->index(builtins[0])), uint16_t(args.size() << 2 | (builtins.size() == 1) << 1 | argsChecked));
+	else if (func != nullptr)
+		c.emit(OpCode::CallDirect, line, c.proto(func), argsChecked);
+	else
+		c.emit(OpCode::Call, line, name.id, uint16_t(args.size()));
+}
+
+inline void ParallelMapExpr::compile(Compiler& c) {
+	array->compile(c);
+	c.emit(OpCode::ParallelMap, line, c.proto(call->func), uint16_t(int(resultElement) << 1 | elementsChecked));
+}
+
+inline void ArrayUpdate::compile(Compiler& c) {
+	for (auto& index : indices)
+		index->compile(c);
+	if (operand != nullptr)
+		operand->compile(c);
+	else
+		c.emitConstant(std::monostate{}, line);
+	auto update = variable->global ? OpCode::UpdateGlobal : OpCode::UpdateLocal;
+	c.emit(update, line, variable->slot, uint16_t(int(op) | indices.size() << 2));
+}
+
+inline void ForStatement::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void ForStatement::compileStatement(Compiler& c, bool) {
+	// The condition follows the body, so each round ends in one conditional jump back.
+	variable->compileStatement(c, false);
+	int enter = c.emit(OpCode::Jump, line);
+	int body = int(c.chunk.code.size());
+	c.compileStatements(forStatements, false);
+	c.patch(enter);
+	int loop = c.compileCondition(*condition, 1, true);
+	c.chunk.code[loop].a = body;
+}
+
+inline void IfStatement::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void IfStatement::compileStatement(Compiler& c, bool) {
+	int skipIf = c.compileCondition(*condition, 0, false);
+	c.compileStatements(ifStatements, true);
+	if (elseStatements.empty()) {
+		c.patch(skipIf);
+		return;
+	}
+	int skipElse = c.emit(OpCode::Jump, line);
+	c.patch(skipIf);
+	c.compileStatements(elseStatements, true);
+	c.patch(skipElse);
+}
+
+inline void ReturnStatement::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void ReturnStatement::compileStatement(Compiler& c, bool) {
+	if (tailCall != nullptr) {
+		for (auto& arg : tailCall->args)
+			arg->compile(c);
+		c.emit(OpCode::TailCall, line, c.proto(tailCall->func), tailCall->argsChecked);
+		return;
+	}
+	if (returnee == nullptr)
+		c.emitConstant(std::monostate{}, line);
+	else
+		returnee->compile(c);
+	c.emit(OpCode::Return, line);
+}
+
+inline void VariableDeclaration::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+// `T x = x + k` and `T x = x - k` on an int or double x and a whole k that fits 16 bits
+// increment the variable in place.
+static bool compileIncrement(Compiler& c, VariableDeclaration& declaration) {
+	auto binary = dynamic_cast<BinaryExpr*>(declaration.expr);
+	if (binary == nullptr || binary->operands != declaration.type || (binary->op != BinaryOperator::Add && binary->op != BinaryOperator::Subtract))
+		return false;
+	auto variable = dynamic_cast<VariableExpr*>(binary->left);
+	if (variable == nullptr || variable->global != declaration.global || variable->slot != declaration.slot)
+		return false;
+	double step;
+	if (auto literal = dynamic_cast<IntExpr*>(binary->right); literal != nullptr && declaration.type == Type::Int)
+		step = double(literal->val);
+	else if (auto literal = dynamic_cast<NumberExpr*>(binary->right); literal != nullptr && declaration.type == Type::Double)
+		step = literal->val;
+	else
+		return false;
+	if (binary->op == BinaryOperator::Subtract)
+		step = -step;
+	if (!(step >= INT16_MIN && step <= INT16_MAX) || std::trunc(step) != step)
+		return false;
+	auto op = declaration.type == Type::Int ?
+		(declaration.global ? OpCode::IncrementGlobalInt : OpCode::IncrementLocalInt) :
+		(declaration.global ? OpCode::IncrementGlobalDouble : OpCode::IncrementLocalDouble);
+	c.emit(op, binary->line, declaration.slot, uint16_t(int16_t(step)));
+	return true;
+}
+
+inline void VariableDeclaration::compileStatement(Compiler& c, bool) {
+	if (compileIncrement(c, *this))
+		return;
+	expr->compile(c);
+	c.emit(global ? OpCode::StoreGlobal : OpCode::StoreLocal, line, slot, uint16_t(int(type) << 1 | checked));
+}
+
+inline void AppendDeclaration::compileStatement(Compiler& c, bool) {
+	auto add = static_cast<BinaryExpr*>(expr);
+	add->right->compile(c);
+	c.emit(global ? OpCode::AppendGlobal : OpCode::AppendLocal, add->line, slot);
+}
+
+inline void FuncDeclaration::compile(Compiler& c) {
+	compileStatement(c, false);
+	c.emitConstant(std::monostate{}, line);
+}
+
+inline void FuncDeclaration::compileStatement(Compiler& c, bool) {
+	int index = c.proto(this);
+	c.emit(OpCode::DefineFunc, line, index);
+	int skipBody = c.emit(OpCode::Jump, line);
+	c.compileBody(index);
+	c.patch(skipBody);
+}
@@ -0,0 +1,346 @@
+#include "vm.h"
+#include <cstdio>
+#include <dirent.h>
+
+
+// A 64-bit hash of the bytes, read eight at a time, for cache keys and for checking cache files.
+static uint64_t contentHash(std::string_view bytes, uint64_t seed) {
+	uint64_t h = seed ^ (bytes.size() * 0x9E37'79B9'7F4A'7C15);
+	size_t i = 0;
+	for (; i + 8 <= bytes.size(); i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes.data() + i, 8);
+		h = (h ^ word) * 0xFF51'AFD7'ED55'8CCD;
+		h ^= h >> 32;
+	}
+	uint64_t tail = 0;
+	if (i != bytes.size())
+		std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+	h = (h ^ tail) * 0xC4CE'B9FE'1A85'EC53;
+	return h ^ (h >> 29);
+}
+
+// Identifies the interpreter that compiled a cached program: the names of its opcodes in order and,
+// since a change to how the compiler lowers a statement alone would leave those the same, either
+// CIKTOR_BUILD, which build.sh defines as a checksum of the sources, or else a hash of the running
+// executable. Both stay the same for a rebuild of the same sources, unlike the time of compilation.
+// Empty if neither is known, which leaves the cache unused.
+#ifndef CIKTOR_BUILD
+#define CIKTOR_BUILD ""
+#endif
+
+static std::string buildIdentity() {
+	std::string identity = CIKTOR_BUILD;
+	if (identity.empty()) {
+		try {
+			MappedFile executable("/proc/self/exe");
+			identity = std::to_string(contentHash(std::string_view(executable.begin(), executable.size()), 0));
+		}
+		catch (ScriptError const&) {
+			return {};
+		}
+	}
+#define X(name) identity += " " #name;
+	OPCODES(X)
+#undef X
+	return identity;
+}
+
+// What the VM runs of a compiled program, which is all the cache keeps. Functions come back as
+// declarations without a body, since the VM only needs their signature, frame and memo table.
+struct CachedProgram {
+	Chunk chunk;
+	size_t globalCount = 0;
+	size_t symbolCount = 0;
+};
+
+// Compiled programs saved in a directory, named by the hash of their source, so a warm start
+// copies the bytecode out of a mapped file instead of parsing and checking the script again.
+// The key also covers the file format, the interpreter's buildIdentity and the program's builtins.
+// The directory keeps the most recently used MaxFiles programs, up to MaxBytes in all; loading
+// a file touches it, and storing one removes the least recently used beyond either bound.
+// A file is, in host byte order: the Header, the instructions, their lines, the constants, the
+// functions, their parameters and the bytes of the string constants.
+class ProgramCache {
+	static constexpr char Magic[8] = "ciktorc";
+	static constexpr uint64_t FormatVersion = 1;
+	static constexpr size_t MaxFiles = 256;
+	static constexpr uint64_t MaxBytes = 64 << 20;
+
+	struct Header {
+		char magic[8];
+		uint64_t key;
+		uint64_t sourceSize;
+		uint64_t checksum; // of everything after the header
+		uint32_t codeSize, constantCount, functionCount, paramCount, stringBytes;
+		int32_t halt;
+		uint32_t globalCount, symbolCount;
+	};
+
+	// An Instruction, whose padding byte would otherwise be written as whatever memory held.
+	struct Code {
+		uint8_t op;
+		uint8_t zero;
+		uint16_t b;
+		int32_t a;
+	};
+
+	// A Void, Bool, Int or Double constant in bits, or a String as stringBytes[bits..bits+length).
+	struct Constant {
+		uint32_t type;
+		uint32_t length;
+		uint64_t bits;
+	};
+
+	struct Function {
+		int32_t name, line, entry, frameSize;
+		uint32_t firstParam, paramCount, returnType, pure;
+	};
+
+	static_assert(sizeof(Header) == 64 && sizeof(Code) == 8 && sizeof(Constant) == 16 && sizeof(Function) == 32);
+	static_assert(sizeof(ParamDeclaration) == 8 && std::is_trivially_copyable_v<ParamDeclaration>);
+#define X(name) + 1
+	static constexpr uint8_t OpCodeCount = 0 OPCODES(X);
+#undef X
+
+	std::string directory;
+	uint64_t seed;
+
+	std::string pathOf(uint64_t key) const {
+		char name[32];
+		std::snprintf(name, sizeof name, "/%016llx.ckc", static_cast<unsigned long long>(key));
+		return directory + name;
+	}
+
+	template<class T>
+	static void append(std::string& file, T const* items, size_t count) {
+		if (count != 0)
+			file.append(reinterpret_cast<char const*>(items), sizeof(T) * count);
+	}
+
+	// Copies count items out of the file at offset, which moves past them. An empty vector's
+	// data() may be null, which memcpy must not get even for no bytes.
+	template<class T>
+	static void read(std::string_view file, size_t& offset, T* items, size_t count) {
+		if (count != 0)
+			std::memcpy(items, file.data() + offset, sizeof(T) * count);
+		offset += sizeof(T) * count;
+	}
+
+public:
+	// $XDG_CACHE_HOME/ciktor, or ~/.cache/ciktor; empty if neither is known.
+	static std::string defaultDirectory() {
+		if (auto cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0')
+			return std::string(cache) + "/ciktor";
+		if (auto home = std::getenv("HOME"); home != nullptr && *home != '\0')
+			return std::string(home) + "/.cache/ciktor";
+		return {};
+	}
+
+	ProgramCache(std::string directory) {
+		auto identity = buildIdentity();
+		if (!identity.empty())
+			this->directory = std::move(directory);
+		seed = contentHash("format " + std::to_string(FormatVersion) + ' ' + identity, 0);
+	}
+
+	// The program's builtins are part of its key, since its bytecode holds their indices.
+	uint64_t key(std::string_view source, BuiltinRegistry const& builtins) const {
+		std::string signatures;
+		for (auto& builtin : builtins.all()) {
+			signatures += ' ' + builtin.name;
+			for (auto type : builtin.params)
+				signatures += ',' + std::to_string(int(type));
+			signatures += ':' + std::to_string(int(builtin.returnType));
+		}
+		return contentHash(source, contentHash(signatures, seed));
+	}
+
+	// Nothing if the program is not cached or its file is damaged.
+	std::optional<CachedProgram> load(uint64_t key, std::string_view source, Arena& arena) const {
+		auto path = pathOf(key);
+		if (directory.empty() || access(path.c_str(), R_OK) != 0)
+			return std::nullopt;
+		std::optional<MappedFile> mapped;
+		try {
+			mapped.emplace(path.c_str());
+		}
+		catch (ScriptError const&) {
+			return std::nullopt;
+		}
+		std::string_view file(mapped->begin(), mapped->size());
+		Header header;
+		if (file.size() < sizeof header)
+			return std::nullopt;
+		std::memcpy(&header, file.data(), sizeof header);
+		uint64_t expected = sizeof header + uint64_t(header.codeSize) * (sizeof(Code) + sizeof(int32_t)) +
+			uint64_t(header.constantCount) * sizeof(Constant) + uint64_t(header.functionCount) * sizeof(Function) +
+			uint64_t(header.paramCount) * sizeof(ParamDeclaration) + header.stringBytes;
+		if (std::memcmp(header.magic, Magic, sizeof Magic) != 0 || header.key != key || header.sourceSize != source.size() ||
+				expected != file.size() || contentHash(file.substr(sizeof header), key) != header.checksum)
+			return std::nullopt;
+
+		CachedProgram program;
+		program.globalCount = header.globalCount;
+		program.symbolCount = header.symbolCount;
+		auto& chunk = program.chunk;
+		chunk.halt = header.halt;
+		size_t offset = sizeof header;
+		std::vector<Code> code(header.codeSize);
+		chunk.code.reserve(header.codeSize);
+		read(file, offset, code.data(), header.codeSize);
+		for (auto& instruction : code) {
+			if (instruction.op >= OpCodeCount)
+				return std::nullopt;
+			chunk.code.push_back(Instruction{OpCode(instruction.op), instruction.b, instruction.a});
+		}
+		chunk.lines.resize(header.codeSize);
+		read(file, offset, chunk.lines.data(), header.codeSize);
+		std::vector<Constant> constants(header.constantCount);
+		read(file, offset, constants.data(), header.constantCount);
+		std::vector<Function> functions(header.functionCount);
+		read(file, offset, functions.data(), header.functionCount);
+		std::vector<ParamDeclaration> params(header.paramCount);
+		read(file, offset, params.data(), header.paramCount);
+		auto strings = file.substr(offset);
+
+		for (auto& constant : constants) {
+			switch (Type(constant.type)) {
+			case Type::Bool:
+				chunk.constants.push_back(Value(constant.bits != 0));
+				break;
+			case Type::Int:
+				chunk.constants.push_back(Value(int64_t(constant.bits)));
+				break;
+			case Type::Double:
+				chunk.constants.push_back(Value(std::bit_cast<double>(constant.bits)));
+				break;
+			case Type::String:
+				if (constant.bits > strings.size() || constant.length > strings.size() - constant.bits)
+					return std::nullopt;
+				chunk.constants.push_back(Value(std::string(strings.substr(constant.bits, constant.length))));
+				break;
+			default:
+				chunk.constants.push_back(std::monostate{});
+			}
+		}
+		for (auto& function : functions) {
+			if (function.firstParam > params.size() || function.paramCount > params.size() - function.firstParam)
+				return std::nullopt;
+			std::vector<ParamDeclaration> own(params.begin() + function.firstParam, params.begin() + function.firstParam + function.paramCount);
+			auto decl = arena.make<FuncDeclaration>(function.line, Symbol{function.name}, arena.list(own),
+				Type(function.returnType), std::span<AST*>(), function.pure != 0);
+			decl->frameSize = function.frameSize;
+			if (decl->pure)
+				decl->memo = std::make_unique<MemoTable>(decl->params.size());
+			chunk.functions.push_back(FuncProto{decl, function.entry});
+		}
+		measureDepth(chunk);
+		utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+		return program;
+	}
+
+	// Best effort: a program that can't be saved is compiled again next time. The file is written
+	// under a temporary name and renamed, so concurrent runs never load half of it.
+	void store(uint64_t key, std::string_view source, Chunk const& chunk, size_t globalCount, size_t symbolCount) const {
+		if (directory.empty())
+			return;
+		std::string strings;
+		std::vector<Constant> constants;
+		for (auto& value : chunk.constants) {
+			Constant constant{uint32_t(value.type()), 0, 0};
+			if (value.isBool())
+				constant.bits = value.asBool();
+			else if (value.isInt())
+				constant.bits = uint64_t(value.asInt());
+			else if (value.isDouble())
+				constant.bits = std::bit_cast<uint64_t>(value.asDouble());
+			else if (value.isString()) {
+				constant.bits = strings.size();
+				constant.length = uint32_t(value.asString().size());
+				strings += value.asString();
+			}
+			else if (!value.isVoid())
+				return; // the compiler emits no array constants, but such a program would not be kept
+			constants.push_back(constant);
+		}
+		std::vector<Function> functions;
+		std::vector<ParamDeclaration> params;
+		for (auto& proto : chunk.functions) {
+			auto decl = proto.decl;
+			functions.push_back(Function{decl->name.id, decl->line, proto.entry, decl->frameSize,
+				uint32_t(params.size()), uint32_t(decl->params.size()), uint32_t(decl->return_type), decl->pure});
+			params.insert(params.end(), decl->params.begin(), decl->params.end());
+		}
+
+		Header header{};
+		std::memcpy(header.magic, Magic, sizeof Magic);
+		header.key = key;
+		header.sourceSize = source.size();
+		header.codeSize = uint32_t(chunk.code.size());
+		header.constantCount = uint32_t(constants.size());
+		header.functionCount = uint32_t(functions.size());
+		header.paramCount = uint32_t(params.size());
+		header.stringBytes = uint32_t(strings.size());
+		header.halt = chunk.halt;
+		header.globalCount = uint32_t(globalCount);
+		header.symbolCount = uint32_t(symbolCount);
+		std::string file(sizeof header, '\0');
+		std::vector<Code> code;
+		for (auto& instruction : chunk.code)
+			code.push_back(Code{uint8_t(instruction.op), 0, instruction.b, instruction.a});
+		append(file, code.data(), code.size());
+		append(file, chunk.lines.data(), chunk.lines.size());
+		append(file, constants.data(), constants.size());
+		append(file, functions.data(), functions.size());
+		append(file, params.data(), params.size());
+		file += strings;
+		header.checksum = contentHash(std::string_view(file).substr(sizeof header), key);
+		std::memcpy(file.data(), &header, sizeof header);
+
+		for (size_t slash = directory.find('/', 1); slash != std::string::npos; slash = directory.find('/', slash + 1))
+			mkdir(directory.substr(0, slash).c_str(), 0755);
+		mkdir(directory.c_str(), 0755);
+		auto path = pathOf(key);
+		auto temporary = path + "." + std::to_string(getpid());
+		int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return;
+		bool written = ::write(fd, file.data(), file.size()) == ssize_t(file.size());
+		close(fd);
+		if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+			unlink(temporary.c_str());
+		evict();
+	}
+
+	// Removes the least recently used files beyond MaxFiles or MaxBytes. Concurrent runs may
+	// remove the same files, or one another's just loaded, which only costs a compile.
+	void evict() const {
+		DIR* listing = opendir(directory.c_str());
+		if (listing == nullptr)
+			return;
+		struct Entry {
+			std::string path;
+			timespec used;
+			uint64_t size;
+		};
+		std::vector<Entry> entries;
+		while (dirent* entry = readdir(listing)) {
+			std::string_view name = entry->d_name;
+			struct stat info;
+			auto path = directory + '/' + entry->d_name;
+			if (name.ends_with(".ckc") && stat(path.c_str(), &info) == 0)
+				entries.push_back(Entry{std::move(path), info.st_mtim, uint64_t(info.st_size)});
+		}
+		closedir(listing);
+		std::sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b) {
+			return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec > b.used.tv_sec : a.used.tv_nsec > b.used.tv_nsec;
+		});
+		uint64_t kept = 0;
+		for (size_t i = 0; i < entries.size(); i++) {
+			kept += entries[i].size;
+			if (i >= MaxFiles || kept > MaxBytes)
+				unlink(entries[i].path.c_str());
+		}
+	}
+};
@@ -1,6 +1,4 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <variant>
 #include <string_view>
 #include <cctype>
@@ -8,123 +6,697 @@
 #include <unordered_map>
 #include <span>
 #include <vector>
+#include <algorithm>
+#include <array>
 #include <memory>
+#include <utility>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+#include <charconv>
+#include <cerrno>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 using namespace std::literals;
 
 
-std::string makeStringRed(std::string str){
+inline std::string makeStringRed(std::string str){
 	return "\033[1;31m" + str + "\033[0m\n";
 }
 
 enum class Type {
 	Void,
 	Bool, 
+	Int,
 	Double,
 	String,
 	Array,
+	// array<T>: arrays whose elements all have type T, in the order of the element types above.
+	BoolArray,
+	IntArray,
+	DoubleArray,
+	StringArray,
+};
+
+static bool isArrayType(Type type) {
+	return type >= Type::Array;
+}
+
+// The array type with the given element type; Void gives the untyped Array.
+static Type arrayOf(Type element) {
+	return Type(int(Type::Array) + int(element));
+}
+
+// The element type of an array type, Void for the untyped Array.
+static Type elementOf(Type array) {
+	return Type(int(array) - int(Type::Array));
+}
+
+// Set on the threads of a running pmap (see WorkerPool). Their values may be copied and dropped
+// on all of them at once, so they update reference counts atomically meanwhile.
+inline thread_local bool threadsRunning = false;
+
+// Heap storage for strings and arrays, shared by every copy of a value.
+struct Object {
+	size_t refs = 1;
+
+	void retain() {
+		if (threadsRunning)
+			std::atomic_ref(refs).fetch_add(1, std::memory_order_relaxed);
+		else
+			refs++;
+	}
+	// Whether that was the last reference.
+	bool drop() {
+		if (threadsRunning)
+			return std::atomic_ref(refs).fetch_sub(1, std::memory_order_acq_rel) == 1;
+		return --refs == 0;
+	}
+	bool shared() const {
+		if (threadsRunning)
+			return std::atomic_ref(const_cast<size_t&>(refs)).load(std::memory_order_acquire) > 1;
+		return refs > 1;
+	}
+};
+
+template<class T>
+struct Box : Object {
+	T value;
+	Box(T value) : value(std::move(value)) {}
 };
 
 struct ArrayElement;
-using Value = std::variant<std::monostate, bool, double, std::string, std::vector<ArrayElement>>;
+
+// A NaN-boxed value. Doubles are stored as themselves (with NaNs canonicalized),
+// everything else is a negative quiet NaN with a tag in bits 48-50 and a 48-bit
+// payload: the boolean for bools, the integer itself for ints that fit in 48 bits,
+// the Box pointer for strings, arrays and larger ints.
+// Tags with bit 50 set are reference-counted heap objects. Boxes are 8-byte aligned, so an
+// array keeps its element type (Type::Void for untyped arrays) in the pointer's low bits.
+class Value {
+	static constexpr uint64_t Boxed = 0xFFF8'0000'0000'0000;
+	static constexpr uint64_t TagMask = 0xFFFF'0000'0000'0000;
+	static constexpr uint64_t PayloadMask = 0x0000'FFFF'FFFF'FFFF;
+	static constexpr uint64_t ElementMask = 7;
+	static constexpr uint64_t PointerMask = PayloadMask & ~ElementMask;
+	static constexpr uint64_t ObjectBit = uint64_t(4) << 48;
+	static constexpr uint64_t CanonicalNaN = 0x7FF8'0000'0000'0000;
+
+	static constexpr uint64_t VoidTag = Boxed | uint64_t(1) << 48;
+	static constexpr uint64_t BoolTag = Boxed | uint64_t(2) << 48;
+	static constexpr uint64_t IntTag = Boxed | uint64_t(3) << 48;
+	static constexpr uint64_t StringTag = Boxed | uint64_t(4) << 48;
+	static constexpr uint64_t ArrayTag = Boxed | uint64_t(5) << 48;
+	static constexpr uint64_t BigIntTag = Boxed | uint64_t(6) << 48;
+
+	uint64_t bits;
+
+	friend struct ElementWords; // the native kernels read array elements as raw words
+
+	explicit Value(uint64_t tag, Object* object) : bits(tag | reinterpret_cast<uintptr_t>(object)) {}
+	bool isObject() const { return (bits & (Boxed | ObjectBit)) == (Boxed | ObjectBit); }
+	Object* object() const { return reinterpret_cast<Object*>(bits & PointerMask); }
+	template<class T> Box<T>* box() const { return static_cast<Box<T>*>(object()); }
+	template<class T> T& mut();
+	void release();
+	void destroy();
+	void box(int64_t number);
+
+public:
+	Value() : bits(VoidTag) {}
+	Value(std::monostate) : Value() {}
+	Value(bool boolean) : bits(BoolTag | boolean) {}
+	[[gnu::always_inline]] Value(int64_t number) : bits(IntTag | (uint64_t(number) & PayloadMask)) {
+		if (int64_t(bits << 16) >> 16 != number)
+			box(number);
+	}
+	Value(double number) : bits(number == number ? std::bit_cast<uint64_t>(number) : CanonicalNaN) {}
+	Value(std::string str) : Value(StringTag, new Box<std::string>(std::move(str))) {}
+	Value(std::vector<ArrayElement> elements, Type elementType = Type::Void);
+	Value(char const*) = delete;
+
+	[[gnu::always_inline]] Value(Value const& other) : bits(other.bits) {
+		if (isObject())
+			object()->retain();
+	}
+	Value(Value&& other) noexcept : bits(std::exchange(other.bits, VoidTag)) {}
+	[[gnu::always_inline]] Value& operator=(Value const& other) {
+		Value copy = other;
+		std::swap(bits, copy.bits);
+		return *this;
+	}
+	[[gnu::always_inline]] Value& operator=(Value&& other) noexcept {
+		if (this != &other) {
+			release();
+			bits = std::exchange(other.bits, VoidTag);
+		}
+		return *this;
+	}
+	[[gnu::always_inline]] ~Value() { release(); }
+
+	bool isDouble() const { return (bits & Boxed) != Boxed; }
+	bool isVoid() const { return bits == VoidTag; }
+	bool isBool() const { return (bits & TagMask) == BoolTag; }
+	bool isInt() const { return (bits & TagMask) == IntTag || (bits & TagMask) == BigIntTag; }
+	// An int held in the value itself rather than boxed, which the VM's typed fast paths take.
+	bool isInlineInt() const { return (bits & TagMask) == IntTag; }
+	bool isNumber() const { return isDouble() || isInt(); }
+	bool isString() const { return (bits & TagMask) == StringTag; }
+	bool isArray() const { return (bits & TagMask) == ArrayTag; }
+
+	Type type() const {
+		static constexpr Type tagTypes[8] = {Type::Void, Type::Void, Type::Bool, Type::Int, Type::String, Type::Array, Type::Int, Type::Void};
+		if (isDouble())
+			return Type::Double;
+		Type type = tagTypes[(bits >> 48) & 7];
+		return type == Type::Array ? arrayOf(elementType()) : type;
+	}
+
+	// For arrays only. Retyping an array changes this value alone, not others sharing its storage;
+	// they copy it before any change (see mut()), so each keeps the elements its type promises.
+	Type elementType() const { return Type(bits & ElementMask); }
+	void setElementType(Type element) { bits = (bits & ~ElementMask) | uint64_t(element); }
+
+	double asDouble() const { return std::bit_cast<double>(bits); }
+	bool asBool() const { return bits & 1; }
+	int64_t asInt() const {
+		if ((bits & TagMask) == IntTag)
+			return int64_t(bits << 16) >> 16;
+		return box<int64_t>()->value;
+	}
+	// Ints are promoted to double for arithmetic with doubles.
+	double asNumber() const { return isInt() ? double(asInt()) : asDouble(); }
+	std::string const& asString() const { return box<std::string>()->value; }
+	std::vector<ArrayElement> const& asArray() const;
+
+	// Memo keys compare strings and boxed ints by content and everything else bit for bit.
+	size_t hash() const {
+		if (isString())
+			return std::hash<std::string>{}(asString());
+		return (bits & TagMask) == BigIntTag ? size_t(asInt()) : size_t(bits);
+	}
+	bool identical(Value const& other) const {
+		if (bits == other.bits)
+			return true;
+		if (isString() && other.isString())
+			return asString() == other.asString();
+		return (bits & TagMask) == BigIntTag && (other.bits & TagMask) == BigIntTag && asInt() == other.asInt();
+	}
+
+	// Copy-on-write access: the storage is copied first if another value shares it.
+	std::string& mutString() { return mut<std::string>(); }
+	std::vector<ArrayElement>& mutArray();
+};
+
 struct ArrayElement {
 	Value value;
 };
 
+inline Value::Value(std::vector<ArrayElement> elements, Type elementType) :
+	Value(ArrayTag, new Box<std::vector<ArrayElement>>(std::move(elements))) {
+	setElementType(elementType);
+}
+
+inline std::vector<ArrayElement> const& Value::asArray() const {
+	return box<std::vector<ArrayElement>>()->value;
+}
+
+inline std::vector<ArrayElement>& Value::mutArray() {
+	return mut<std::vector<ArrayElement>>();
+}
+
+template<class T>
+T& Value::mut() {
+	auto current = box<T>();
+	if (current->shared()) {
+		auto copy = new Box<T>(current->value);
+		release(); // the other owners may have let go meanwhile
+		bits = (bits & ~PointerMask) | reinterpret_cast<uintptr_t>(static_cast<Object*>(copy));
+		current = copy;
+	}
+	return current->value;
+}
+
+// Ints beyond 48 bits are rare enough to live on the heap, out of line of the arithmetic.
+[[gnu::noinline]] inline void Value::box(int64_t number) {
+	bits = BigIntTag | reinterpret_cast<uintptr_t>(static_cast<Object*>(new Box<int64_t>(number)));
+}
+
+// Forced inline into every destructor, including the VM's dispatch loop; freeing the storage is the rare case.
+[[gnu::always_inline]] inline void Value::release() {
+	if (isObject() && object()->drop())
+		destroy();
+}
+
+[[gnu::noinline]] inline void Value::destroy() {
+	if (isString())
+		delete box<std::string>();
+	else if (isArray())
+		delete box<std::vector<ArrayElement>>();
+	else
+		delete box<int64_t>();
+}
+
+// Bump allocator for the parsed program: nodes and their child lists are packed into large
+// blocks in parse order and released together. Only objects with non-trivial destructors
+// (such as nodes holding a Value) are remembered and destroyed individually.
+class Arena {
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	struct Finalizer {
+		void (*destroy)(void*);
+		void* object;
+	};
+
+	std::vector<std::unique_ptr<std::byte[]>> blocks;
+	uintptr_t cursor = 0;
+	uintptr_t end = 0;
+	std::vector<Finalizer> finalizers;
+
+	void* allocate(size_t size, size_t align) {
+		uintptr_t start = (cursor + align - 1) & ~(align - 1);
+		if (cursor == 0 || start + size > end) {
+			size_t blockSize = std::max(BlockSize, size + align);
+			blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(blockSize));
+			cursor = reinterpret_cast<uintptr_t>(blocks.back().get());
+			end = cursor + blockSize;
+			start = (cursor + align - 1) & ~(align - 1);
+		}
+		cursor = start + size;
+		return reinterpret_cast<void*>(start);
+	}
+
+public:
+	Arena() = default;
+	Arena(Arena const&) = delete;
+	Arena& operator=(Arena const&) = delete;
+	~Arena() {
+		for (auto it = finalizers.rbegin(); it != finalizers.rend(); ++it)
+			it->destroy(it->object);
+	}
+
+	template<class T, class... Args>
+	T* make(Args&&... args) {
+		T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr (!std::is_trivially_destructible_v<T>)
+			finalizers.push_back(Finalizer{[](void* p) { static_cast<T*>(p)->~T(); }, object});
+		return object;
+	}
+
+	// Copies a list the parser collected into the arena.
+	template<class T>
+	std::span<T> list(std::vector<T> const& items) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		if (items.empty())
+			return {};
+		T* copy = static_cast<T*>(allocate(sizeof(T) * items.size(), alignof(T)));
+		std::memcpy(copy, items.data(), sizeof(T) * items.size());
+		return {copy, items.size()};
+	}
+};
+
 struct Ctx;
-static Type type_of_value(Value value) {
-	return (Type)value.index();
+struct Compiler;
+struct Resolver;
+struct Folder;
+struct TypeChecker;
+static Type type_of_value(Value const& value) {
+	return value.type();
+}
+
+static bool converted(Value& value, Type type);
+
+// Whether the value can go where the type is declared. An int is promoted in place where a double
+// is expected, and a double with a whole value in range becomes an int where an int is expected
+// (before ints were 64-bit, `int` declared a double, so scripts pass results of / and string
+// subtraction to int variables and parameters). Arrays are retyped as described at converted().
+static inline bool conforms(Value& value, Type type) {
+	return value.type() == type || converted(value, type);
+}
+
+// Any array is an untyped array. An array becomes an array<T> once every element is checked
+// to conform to T, which is linear, but arrays built or returned as array<T> already are one.
+static bool converted(Value& value, Type type) {
+	if (value.isInt() && type == Type::Double) {
+		value = value.asNumber();
+		return true;
+	}
+	if (value.isDouble() && type == Type::Int) {
+		double number = value.asDouble();
+		if (!(number >= -0x1p63 && number < 0x1p63) || std::trunc(number) != number)
+			return false;
+		value = int64_t(number);
+		return true;
+	}
+	if (!value.isArray() || !isArrayType(type))
+		return false;
+	Type element = elementOf(type);
+	if (element != Type::Void) {
+		auto& elements = value.asArray();
+		auto conforming = [element](ArrayElement const& e) {
+			return e.value.type() == element || (element == Type::Double && e.value.isInt());
+		};
+		if (!std::ranges::all_of(elements, conforming))
+			return false;
+		if (element == Type::Double && std::ranges::any_of(elements, [](auto& e) { return e.value.isInt(); }))
+			for (auto& e : value.mutArray())
+				conforms(e.value, Type::Double);
+	}
+	value.setElementType(element);
+	return true;
+}
+
+// Numbers print like iostream's default (%g with 6 digits); strings get them like std::to_string (%f).
+static std::string_view formatNumber(char (&digits)[32], double number) {
+	return {digits, size_t(std::to_chars(digits, digits + sizeof digits, number, std::chars_format::general, 6).ptr - digits)};
+}
+
+static std::string_view formatInteger(char (&digits)[32], int64_t number) {
+	return {digits, size_t(std::to_chars(digits, digits + sizeof digits, number).ptr - digits)};
+}
+
+static std::string fixedNumber(double number) {
+	char digits[400];
+	return {digits, size_t(std::to_chars(digits, digits + sizeof digits, number, std::chars_format::fixed, 6).ptr - digits)};
+}
+
+// Buffered output for everything a program prints: stdout, or the stream an embedding host gives.
+// It is flushed when full, before input is read, when the program ends or fails; with --unbuffered
+// also after every print.
+class Output {
+	static constexpr size_t Capacity = 64 * 1024;
+	char buffer[Capacity];
+	size_t size = 0;
+	std::ostream* stream = nullptr;
+
+	void writeAll(char const* data, size_t length) {
+		if (stream != nullptr) {
+			stream->write(data, std::streamsize(length));
+			return;
+		}
+		while (length > 0) {
+			ssize_t written = ::write(STDOUT_FILENO, data, length);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				return;
+			}
+			data += written;
+			length -= written;
+		}
+	}
+
+public:
+	bool unbuffered = false;
+
+	Output() = default;
+	Output(std::ostream& stream) : stream(&stream) {}
+	Output(Output const&) = delete;
+	Output& operator=(Output const&) = delete;
+	~Output() { flush(); }
+
+	void flush() {
+		writeAll(buffer, size);
+		size = 0;
+		if (stream != nullptr)
+			stream->flush();
+	}
+
+	void write(std::string_view text) {
+		if (size + text.size() > Capacity) {
+			flush();
+			if (text.size() > Capacity) {
+				writeAll(text.data(), text.size());
+				return;
+			}
+		}
+		std::memcpy(buffer + size, text.data(), text.size());
+		size += text.size();
+	}
+
+	void put(char c) {
+		if (size == Capacity)
+			flush();
+		buffer[size++] = c;
+	}
+
+	void number(double number) {
+		char digits[32];
+		write(formatNumber(digits, number));
+	}
+
+	void integer(int64_t number) {
+		char digits[32];
+		write(formatInteger(digits, number));
+	}
+
+	// The end of a print statement.
+	void printed() {
+		if (unbuffered)
+			flush();
+	}
+};
+
+// How a program failed or stopped early. Whoever runs it reports it; the command line prints it
+// to stderr and exits with status 1.
+struct ScriptError : std::runtime_error {
+	enum class Kind {
+		Error,  // a syntax, type or runtime error at line
+		Thrown, // throw(x), the message is x as text
+		Exit,   // exit()
+	};
+	Kind kind;
+	int line; // counted from 0, -1 where no line applies (a file that can't be read)
+
+	ScriptError(Kind kind, int line, std::string message) :
+		std::runtime_error(std::move(message)), kind(kind), line(line) {}
+};
+
+[[noreturn]] inline void runtimeError(int line, char const* message) {
+	throw ScriptError(ScriptError::Kind::Error, line, message);
+}
+
+// Called from a catch (...) around code that runs the script: a C++ exception the interpreter
+// didn't expect, such as std::bad_alloc, becomes the ScriptError of the given line, so it can't
+// end the process. ScriptErrors pass through unchanged.
+[[noreturn]] inline void rethrowAsScriptError(int line) {
+	try {
+		throw;
+	}
+	catch (ScriptError const&) {
+		throw;
+	}
+	catch (std::bad_alloc const&) {
+		runtimeError(line, "out of memory");
+	}
+	catch (std::exception const& error) {
+		runtimeError(line, error.what());
+	}
 }
 
 struct AST {
 	AST(int line) : line(line) {}
-	virtual ~AST() = default;
 	[[noreturn]] void error(char const* message) {
-		std::cerr << line + 1 << ": " << makeStringRed(message) << '\n';
-		std::exit(1);
+		runtimeError(line, message);
 	}
 	virtual Value evaluate(Ctx&) = 0;
+	virtual void resolve(Resolver&) = 0;
+	virtual void compile(Compiler&) = 0;
+	virtual void compileStatement(Compiler&, bool checkVoid);
+	virtual AST* fold(Folder&);
+	// Returns the node to use in place of this one; the inferred type is left in the checker.
+	virtual AST* check(TypeChecker&) = 0;
+	// Statements that always evaluate to void, so they need no "Statement is not void" check.
+	virtual bool alwaysVoid() const { return false; }
 	int line;
 };
 
-using UPAST = std::unique_ptr<AST>;
+// An interned identifier: a dense index into the lexer's symbol table.
+struct Symbol {
+	int id;
+	bool operator==(Symbol const&) const = default;
+};
 
 struct ParamDeclaration {
 	Type type;
-	std::string_view name;
+	Symbol name;
+};
+
+// Cached results of a pure function, keyed by its argument values. Every argument list hashes to
+// one entry, which a colliding list overwrites, so the table never grows past Capacity entries.
+class MemoTable {
+	static constexpr size_t Capacity = 4096;
+
+	struct Entry {
+		bool filled = false;
+		Value result;
+	};
+
+	std::vector<Value> keys; // arity arguments per entry
+	std::vector<Entry> entries;
+
+	size_t slotOf(std::span<Value const> args) const {
+		uint64_t h = 0;
+		for (auto& arg : args)
+			h = (h ^ arg.hash()) * 0x9E37'79B9'7F4A'7C15;
+		return h >> (64 - std::countr_zero(Capacity));
+	}
+
+public:
+	size_t const arity;
+	size_t hits = 0;
+	size_t misses = 0;
+
+	explicit MemoTable(size_t arity) : keys(Capacity * arity), entries(Capacity), arity(arity) {}
+
+	Value const* find(std::span<Value const> args) {
+		size_t slot = slotOf(args);
+		if (entries[slot].filled && std::ranges::equal(args, std::span(keys).subspan(slot * arity, arity),
+				[](Value const& a, Value const& b) { return a.identical(b); })) {
+			hits++;
+			return &entries[slot].result;
+		}
+		misses++;
+		return nullptr;
+	}
+
+	void store(std::span<Value const> args, Value result) {
+		size_t slot = slotOf(args);
+		std::ranges::copy(args, keys.begin() + slot * arity);
+		entries[slot] = Entry{true, std::move(result)};
+	}
 };
 
 struct Func {
 	std::span<ParamDeclaration const> params;
 	Type return_type;
-	std::span<UPAST const> body;
+	std::span<AST*> body;
+	int frameSize = 0;
+	int entry = -1;
+};
+
+// How the last statement finished; anything but Normal unwinds the enclosing statement lists.
+enum class Completion {
+	Normal,
+	Return,
+	TailCall, // the callee's arguments are on top of the stack, ready to replace the frame
 };
 
+class InputReader;
+
 struct Ctx {
-	std::unordered_map<std::string_view, Value> values;
-	std::unordered_map<std::string_view, Func> funcs;
+	Output* output = nullptr; // where print goes; pmap workers, which run pure functions only, have none
+	InputReader* input = nullptr;
+	std::vector<Value> globals;
+	std::vector<Value> stack;
+	size_t frame = 0;
+	std::vector<Func> funcs; // indexed by Symbol::id
+	Completion completion = Completion::Normal;
+	Value returnValue;
+	struct FuncCallExpression* tailCall = nullptr;
 };
 
-static void evalStatements(Ctx& ctx, std::span<UPAST const> statements) {
+static void evalStatements(Ctx& ctx, std::span<AST*> statements) {
 	for (auto& statement : statements) {
-		if (type_of_value(statement->evaluate(ctx)) != Type::Void)
-			statement->error("Statement is not void");
+		try {
+			if (type_of_value(statement->evaluate(ctx)) != Type::Void)
+				statement->error("Statement is not void");
+		}
+		catch (...) {
+			rethrowAsScriptError(statement->line);
+		}
+		if (ctx.completion != Completion::Normal)
+			return;
 	}
 };
 
-void printValue(const Value& val){
+inline void writeValue(Output& output, const Value& val){
 
-	if (auto str = std::get_if<std::string>(&val)) {
-		std::cout << *str;
+	if (val.isString()) {
+		output.write(val.asString());
 	}
-	else if(auto arr = std::get_if<std::vector<ArrayElement>>(&val)){
-		std::cout << "[";
-		for(int i = 0; i < arr->size();i++){
+	else if(val.isArray()){
+		auto& arr = val.asArray();
+		output.put('[');
+		for(int i = 0; i < arr.size();i++){
 			if(i > 0)
-				std::cout << ", ";
-			printValue((*arr)[i].value);
+				output.write(", ");
+			writeValue(output, arr[i].value);
 		}
-		std::cout << "]";
+		output.put(']');
 
 	}
-	else if (auto number = std::get_if<double>(&val)) {
-		std::cout << *number;
+	else if (val.isDouble()) {
+		output.number(val.asDouble());
+	}
+	else if (val.isInt()) {
+		output.integer(val.asInt());
 	}
-	else if (auto boolean = std::get_if<bool>(&val)) {
-		std::cout << (*boolean ? "true" : "false");
+	else if (val.isBool()) {
+		output.write(val.asBool() ? "true" : "false");
 	}
 	else {
-		std::cout << "void";
+		output.write("void");
 	}
 }
-void throwError(const Value& val){
 
-	if (auto str = std::get_if<std::string>(&val)) {
-		std::cerr << *str;
+inline void printValue(Output& output, const Value& val) {
+	writeValue(output, val);
+	output.printed();
+}
+
+inline void printNewline(Output& output) {
+	output.put('\n');
+	output.printed();
+}
+inline void throwError(std::ostream& message, const Value& val){
+
+	if (val.isString()) {
+		message << val.asString();
 	}
-	else if(auto arr = std::get_if<std::vector<ArrayElement>>(&val)){
-		std::cerr << "[";
-		for(int i = 0; i < arr->size();i++){
+	else if(val.isArray()){
+		auto& arr = val.asArray();
+		message << "[";
+		for(int i = 0; i < arr.size();i++){
 			if(i > 0)
-				std::cerr << ", ";
-			throwError((*arr)[i].value);
+				message << ", ";
+			throwError(message, arr[i].value);
 		}
-		std::cerr << "]";
+		message << "]";
 
 	}
-	else if (auto number = std::get_if<double>(&val)) {
-		std::cerr << std::to_string(*number);
+	else if (val.isDouble()) {
+		message << fixedNumber(val.asDouble());
 	}
-	else if (auto boolean = std::get_if<bool>(&val)) {
-		std::cerr << *boolean ? "true" : "false";
+	else if (val.isInt()) {
+		message << val.asInt();
+	}
+	else if (val.isBool()) {
+		message << val.asBool() ? "true" : "false";
 	}
 	else {
-		std::cerr << "void";
+		message << "void";
 	}
 	
 }
 
+// throw(x): the value as text becomes the message of the error.
+[[noreturn]] inline void throwValue(int line, const Value& val) {
+	std::ostringstream message;
+	throwError(message, val);
+	throw ScriptError(ScriptError::Kind::Thrown, line, std::move(message).str());
+}
+
 enum class BinaryOperator {
 	Add,
 	Subtract,
@@ -145,4 +717,8 @@ enum class BinaryOperator {
 
 enum class ExtendedToken { RightArrow, SlashSlash, EqualsEquals, LessEquals, GreaterEquals, NotEquals, AndAnd, OrOr };
 
-using Token = std::variant<int, ExtendedToken, double, std::string_view, std::string>;
+enum class Keyword { If, Else, For, Func, Print, Throw, Return, Void, Array, Bool, Int, Double, String, Input, Exit, True, False, Pure, Push, Pop, Reserve, ReadAll, ReadLines, Pmap };
+
+// A std::string_view token is a string literal's contents, viewed in the source text.
+// Integer literals are int64_t; those too large for it are lexed as doubles.
+using Token = std::variant<int, ExtendedToken, int64_t, double, Symbol, std::string_view, Keyword>;
@@ -2,35 +2,211 @@
 
 
 struct VariableDeclaration : AST {
-	std::string_view name;
+	Symbol name;
 	Type type;
-	UPAST expr;
+	AST* expr;
+	int slot = -1;
+	bool global = false;
+	bool checked = false; // the type checker proved the value to have the declared scalar type
 
-	VariableDeclaration(int line, std::string_view name, Type type, UPAST expr) :
-		AST(line), expr(std::move(expr)), name(name), type(type){}
+	VariableDeclaration(int line, Symbol name, Type type, AST* expr) :
+		AST(line), expr(expr), name(name), type(type){}
 	
 	Value evaluate(Ctx& ctx) {
 		Value val = expr->evaluate(ctx);
-		if (type_of_value(val) != type)
+		if (!checked && !conforms(val, type))
 			error("wrong type of variable initializer");
-		ctx.values[name] = val;
+		(global ? ctx.globals[slot] : ctx.stack[ctx.frame + slot]) = std::move(val);
 		return std::monostate{};
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
+};
+
+// `string s = s + x` on a slot that only ever holds strings, made by the type checker: x is
+// appended to the variable's string in place.
+struct AppendDeclaration : VariableDeclaration {
+	AppendDeclaration(VariableDeclaration const& declaration) : VariableDeclaration(declaration) {}
+
+	Value evaluate(Ctx& ctx) {
+		auto add = static_cast<BinaryExpr*>(expr);
+		if (type_of_value(global ? ctx.globals[slot] : ctx.stack[ctx.frame + slot]) == Type::Void)
+			add->left->error("no such variable");
+		Value right = add->right->evaluate(ctx);
+		appendInPlace(add->line, global ? ctx.globals[slot] : ctx.stack[ctx.frame + slot], std::move(right));
+		return std::monostate{};
+	}
+	void compileStatement(Compiler& c, bool checkVoid);
 };
 
 
 
 struct FuncDeclaration : AST {
-	std::string_view name;
-	std::vector<ParamDeclaration> params;
+	Symbol name;
+	std::span<ParamDeclaration const> params;
 	Type return_type;
-	std::vector<UPAST> body;
+	std::span<AST*> body;
+	int frameSize = 0;
+	std::vector<std::optional<Type>> slotTypes;
+	bool pure;
+	std::unique_ptr<MemoTable> memo; // created by the type checker once it has verified a pure function
 	
-	FuncDeclaration(int line, std::string_view name, std::vector<ParamDeclaration>&& params, Type return_type, std::vector<UPAST>&& body) :
-		AST(line), name(name), params(std::move(params)),return_type(return_type), body(std::move(body)) {}
+	FuncDeclaration(int line, Symbol name, std::span<ParamDeclaration const> params, Type return_type, std::span<AST*> body, bool pure) :
+		AST(line), name(name), params(params),return_type(return_type), body(body), pure(pure) {}
 	
 	Value evaluate(Ctx& ctx) {
-		ctx.funcs[name] = Func{params, return_type, body};
+		ctx.funcs[name.id] = Func{params, return_type, body, frameSize};
 		return std::monostate{};
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
+
+// pmap(f, xs): the array of f(x) for every element x of xs, computed on all cores. The checker
+// only admits a pure f, so the calls share nothing but the elements; each worker has its own stack.
+struct ParallelMapExpr : AST {
+	FuncCallExpression* call; // linked to f like a call, its argument comes from the array
+	AST* array;
+	bool elementsChecked = false; // the elements have f's parameter type
+	Type resultElement = Type::Void; // set by the type checker
+
+	ParallelMapExpr(int line, FuncCallExpression* call, AST* array) :
+		AST(line), call(call), array(array) {}
+
+	Value evaluate(Ctx& ctx);
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+};
+
+template<class F>
+void FuncCallExpression::pushArgs(Ctx& ctx, F const& func) {
+	for (size_t i = 0; i < args.size(); i++){
+		auto arg_value = args[i]->evaluate(ctx);
+		if (!argsChecked && !conforms(arg_value, func.params[i].type))
+			args[i]->error("wrong type of argument");
+		ctx.stack.push_back(std::move(arg_value));
+	}
+}
+
+template<class F>
+Value FuncCallExpression::invoke(Ctx& ctx, F const& func) {
+	size_t base = ctx.stack.size();
+	pushArgs(ctx, func);
+	return execute(ctx, base, func);
+}
+
+// Runs the body over a frame whose arguments start at base. F is the linked FuncDeclaration or the
+// Func registered in Ctx::funcs; both have the same fields. Tail calls made by the body run in this
+// same frame: the loop slides their arguments down over it and continues with the callee's body,
+// which returns the same type.
+template<class F>
+Value FuncCallExpression::execute(Ctx& ctx, size_t base, F const& func) {
+	size_t callerFrame = ctx.frame;
+	ctx.frame = base;
+	FuncCallExpression* call = this;
+	std::span<AST*> body = func.body;
+	int frameSize = func.frameSize;
+	while (true) {
+		ctx.stack.resize(base + frameSize);
+		evalStatements(ctx, body);
+		if (ctx.completion != Completion::TailCall)
+			break;
+		ctx.completion = Completion::Normal;
+		call = ctx.tailCall;
+		size_t argc = call->args.size();
+		std::move(ctx.stack.end() - argc, ctx.stack.end(), ctx.stack.begin() + base);
+		ctx.stack.resize(base + argc);
+		body = call->func->body;
+		frameSize = call->func->frameSize;
+	}
+	ctx.frame = callerFrame;
+	ctx.stack.resize(base);
+
+	if (ctx.completion == Completion::Return) {
+		ctx.completion = Completion::Normal;
+		if(!conforms(ctx.returnValue, func.return_type))
+			call->error("Type missmatch. Return type must match function type");
+		return std::move(ctx.returnValue);
+	}
+	
+	if(func.return_type == Type::Void)
+		return std::monostate{};
+	call->error("Reached end of non-void function");
+}
+
+// Evaluates a tail call's arguments above the current frame and unwinds to the enclosing invoke.
+inline void FuncCallExpression::pushTailArgs(Ctx& ctx) {
+	pushArgs(ctx, *func);
+	ctx.tailCall = this;
+	ctx.completion = Completion::TailCall;
+}
+
+// The arguments of a pure call stay below its frame as the memo key while the body runs on copies.
+inline Value FuncCallExpression::memoized(Ctx& ctx) {
+	size_t base = ctx.stack.size();
+	pushArgs(ctx, *func);
+	auto& memo = *func->memo;
+	if (auto hit = memo.find(std::span(ctx.stack).subspan(base))) {
+		Value result = *hit;
+		ctx.stack.resize(base);
+		return result;
+	}
+	for (size_t i = 0; i < args.size(); i++)
+		ctx.stack.push_back(Value(ctx.stack[base + i]));
+	Value result = execute(ctx, base + args.size(), *func);
+	memo.store(std::span(ctx.stack).subspan(base, args.size()), result);
+	ctx.stack.resize(base);
+	return result;
+}
+
+// Builtins get their arguments in place on the stack, like the frame of a script function.
+inline Value FuncCallExpression::callNative(Ctx& ctx) {
+	size_t base = ctx.stack.size();
+	for (auto arg : args)
+		ctx.stack.push_back(arg->evaluate(ctx));
+	Value result = callBuiltin(line, builtins, argsChecked, std::span(ctx.stack).subspan(base));
+	ctx.stack.resize(base);
+	return result;
+}
+
+// Linked calls were arity-checked statically; the rest find their function when they run and
+// copy it, since the body may redefine it. pmap workers skip the memo tables, which are not synchronized.
+inline Value FuncCallExpression::evaluate(Ctx& ctx) {
+	if (!builtins.empty())
+		return callNative(ctx);
+	if (func != nullptr)
+		return func->memo != nullptr && !threadsRunning ? memoized(ctx) : invoke(ctx, *func);
+	auto registered = ctx.funcs[name.id];
+	if (registered.params.size() != args.size())
+		error("Invalid number of arguments ?!");
+	return invoke(ctx, registered);
+}
+
+inline Value ParallelMapExpr::evaluate(Ctx& ctx) {
+	Value source = array->evaluate(ctx);
+	if (!source.isArray())
+		error("NOT AN ARRAY");
+	auto& elements = source.asArray();
+	auto func = call->func;
+	std::vector<ArrayElement> results(elements.size());
+	std::vector<Ctx> workers(pool.size());
+	pool.run(elements.size(), [&](size_t i, size_t self) {
+		Ctx& worker = workers[self];
+		size_t base = worker.stack.size();
+		worker.stack.push_back(elements[i].value);
+		if (!elementsChecked && !conforms(worker.stack.back(), func->params[0].type))
+			error("wrong type of argument");
+		results[i].value = call->execute(worker, base, *func);
+	});
+	return Value(std::move(results), resultElement);
+}
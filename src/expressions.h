@@ -1,39 +1,58 @@
-#include "Lexer.h"
+#include "pool.h"
 
 
 struct ArrayExpr : AST {
-	std::vector<UPAST> elements;
-	ArrayExpr(int line, std::vector<UPAST> elements) : AST(line), elements(std::move(elements)){}
+	std::span<AST*> elements;
+	Type elementType = Type::Void; // set by the type checker when every element has the same type
+	ArrayExpr(int line, std::span<AST*> elements) : AST(line), elements(elements){}
 
 	Value evaluate(Ctx& ctx) {
 		std::vector<ArrayElement> arrayElems;
+		arrayElems.reserve(elements.size());
 		for(auto& i : elements){
 			arrayElems.push_back(ArrayElement{i->evaluate(ctx)});
 		}
-		return arrayElems;
+		return Value(std::move(arrayElems), elementType);
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
 };
 
 struct StringExpr : AST {
-	std::string val;
+	Value val;
 
-	StringExpr(int line, std::string val) : AST(line), val(val) {}
+	StringExpr(int line, std::string val) : AST(line), val(std::move(val)) {}
 	
 	Value evaluate(Ctx&) {
 		return val;
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
 };
 
 struct VariableExpr : AST {
-	std::string_view val;
+	Symbol name;
+	int slot = -1;
+	bool global = false;
 	
-	VariableExpr(int line, std::string_view val) : AST(line), val(val) {}
+	VariableExpr(int line, Symbol name) : AST(line), name(name) {}
 	
+	// The variable's slot itself, for statements that update it in place.
+	Value& storage(Ctx& ctx) {
+		Value& value = global ? ctx.globals[slot] : ctx.stack[ctx.frame + slot];
+		if (type_of_value(value) == Type::Void)
+			error("no such variable");
+		return value;
+	}
 	Value evaluate(Ctx& ctx) {
-		if(auto it = ctx.values.find(val); it != ctx.values.end())
-			return it->second;
-		error("no such variable");
+		return storage(ctx);
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
 };
 
 struct NumberExpr : AST {
@@ -44,276 +63,842 @@ struct NumberExpr : AST {
 	Value evaluate(Ctx&) {
 		return val;
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
+};
+
+struct IntExpr : AST {
+	int64_t val;
+
+	IntExpr(int line, int64_t val) : AST(line), val(val) {}
+
+	Value evaluate(Ctx&) {
+		return val;
+	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
+};
+
+struct BoolExpr : AST {
+	bool val;
+
+	BoolExpr(int line, bool val) : AST(line), val(val) {}
+
+	Value evaluate(Ctx&) {
+		return val;
+	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
 };
 
 struct NotExpr : AST {
-	UPAST operand;
+	AST* operand;
 	
-	NotExpr(int line, UPAST operand) : AST(line), operand(std::move(operand)) {}
+	NotExpr(int line, AST* operand) : AST(line), operand(operand) {}
 	
 	Value evaluate(Ctx& ctx) {
 		Value val = operand->evaluate(ctx);
-		if (auto boolean = std::get_if<bool>(&val)) {
-			return !*boolean;
+		if (val.isBool()) {
+			return !val.asBool();
 		}
 		else {
 			error("TYPE IS NOT BOOLEAN");
 		}
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+};
+
+// Buffered input for input(), readAll() and readLines(): stdin, or the stream an embedding host
+// gives. A regular file on stdin is memory-mapped on first use; pipes, terminals and streams are
+// read in large chunks as lines are needed.
+class InputReader {
+	static constexpr size_t ChunkSize = 64 * 1024;
+	std::istream* stream = nullptr;
+	bool opened = false;
+	char const* mapping = nullptr;
+	size_t mappingLength = 0;
+	std::string buffer; // unmapped input read so far, consumed up to cursor
+	size_t cursor = 0;  // into the mapping or the buffer
+	bool eof = false;
+
+	void open() {
+		opened = true;
+		if (stream != nullptr)
+			return;
+		struct stat info;
+		off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+		if (offset < 0 || fstat(STDIN_FILENO, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size <= offset)
+			return;
+		void* mapped = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+		if (mapped == MAP_FAILED)
+			return;
+		madvise(mapped, size_t(info.st_size), MADV_SEQUENTIAL);
+		mapping = static_cast<char const*>(mapped);
+		mappingLength = size_t(info.st_size);
+		cursor = size_t(offset);
+	}
+
+	// Appends another chunk of unmapped input, dropping what was consumed; false at the end.
+	bool fill() {
+		if (mapping != nullptr || eof)
+			return false;
+		buffer.erase(0, cursor);
+		cursor = 0;
+		size_t size = buffer.size();
+		buffer.resize(size + ChunkSize);
+		ssize_t count;
+		if (stream != nullptr) {
+			stream->read(buffer.data() + size, ChunkSize);
+			count = stream->gcount();
+		}
+		else {
+			do
+				count = ::read(STDIN_FILENO, buffer.data() + size, ChunkSize);
+			while (count < 0 && errno == EINTR);
+		}
+		buffer.resize(size + std::max<ssize_t>(count, 0));
+		eof = count <= 0;
+		return !eof;
+	}
+
+	std::string_view unread() const {
+		if (mapping != nullptr)
+			return {mapping + cursor, mappingLength - cursor};
+		return std::string_view(buffer).substr(cursor);
+	}
+
+	std::string_view readToEnd() {
+		if (!opened)
+			open();
+		while (fill()) {}
+		auto rest = unread();
+		cursor += rest.size();
+		return rest;
+	}
+
+public:
+	InputReader() = default;
+	InputReader(std::istream& stream) : stream(&stream) {}
+	InputReader(InputReader const&) = delete;
+	InputReader& operator=(InputReader const&) = delete;
+	~InputReader() {
+		if (mapping != nullptr)
+			munmap(const_cast<char*>(mapping), mappingLength);
+	}
+
+	// The next line without its '\n', like std::getline; empty at the end of input.
+	std::string line() {
+		if (!opened)
+			open();
+		size_t scanned = 0;
+		while (true) {
+			auto rest = unread();
+			size_t newline = rest.find('\n', scanned);
+			if (newline != std::string_view::npos) {
+				cursor += newline + 1;
+				return std::string(rest.substr(0, newline));
+			}
+			scanned = rest.size();
+			if (!fill()) {
+				rest = unread();
+				cursor += rest.size();
+				return std::string(rest);
+			}
+		}
+	}
+
+	std::string all() {
+		return std::string(readToEnd());
+	}
+
+	// The remaining lines; a final '\n' does not start another one.
+	std::vector<ArrayElement> lines() {
+		auto rest = readToEnd();
+		std::vector<ArrayElement> result;
+		result.reserve(std::ranges::count(rest, '\n') + 1);
+		while (!rest.empty()) {
+			size_t newline = std::min(rest.find('\n'), rest.size());
+			result.push_back(ArrayElement{std::string(rest.substr(0, newline))});
+			rest.remove_prefix(std::min(newline + 1, rest.size()));
+		}
+		return result;
+	}
+};
+
+enum class InputMode {
+	Line,  // input()
+	All,   // readAll()
+	Lines, // readLines()
 };
 
+static Value readInput(Ctx& ctx, InputMode mode) {
+	ctx.output->flush();
+	switch (mode) {
+	case InputMode::Line:
+		return ctx.input->line();
+	case InputMode::All:
+		return ctx.input->all();
+	case InputMode::Lines:
+		return Value(ctx.input->lines(), Type::String);
+	}
+	return std::monostate{};
+}
+
 struct InputExpr : AST {
-	InputExpr(int line) : AST(line) {}
-	Value evaluate(Ctx&) {
-		std::string val;
-		std::getline(std::cin, val);
-		return val;
+	InputMode mode;
+	InputExpr(int line, InputMode mode) : AST(line), mode(mode) {}
+	Value evaluate(Ctx& ctx) {
+		return readInput(ctx, mode);
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
 };
 
 struct exitExpr : AST {
 	exitExpr(int line) : AST(line) {}
 	Value evaluate(Ctx&) {
-		exit(1);
+		throw ScriptError(ScriptError::Kind::Exit, line, "exit");
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* check(TypeChecker& c);
 };
 
-struct BinaryExpr : AST {
-	UPAST left, right;
-	BinaryOperator op;
-	BinaryExpr(int line, UPAST left, UPAST right, BinaryOperator op) :
-		AST(line), left(std::move(left)), right(std::move(right)), op(op) {}
-	Value evaluate(Ctx& ctx) {
-		Value leftVal = left->evaluate(ctx);
-		Value rightVal = right->evaluate(ctx);
-		if(op == BinaryOperator::Index){
-			if(auto leftArr = std::get_if<std::string>(&leftVal)) {
-				if(auto rightNumber = std::get_if<double>(&rightVal)){
-					if(
-					*rightNumber >= 0 &&
-					*rightNumber < leftArr->size() && 
-					int(*rightNumber) == *rightNumber
-					)
-						return std::string{(*leftArr)[*rightNumber]};
-				}
+// x % y on doubles, exactly as std::fmod computes it. Whole operands that fit in an int64 take the
+// integer remainder instead, several times faster than fmod; it has the sign of x, like fmod, and
+// copysign keeps that for a zero result too (fmod(-4, 2) is -0).
+static inline double remainderOf(double left, double right) {
+	if (left >= -0x1p63 && left < 0x1p63 && right >= -0x1p63 && right < 0x1p63) {
+		int64_t l = int64_t(left), r = int64_t(right);
+		if (double(l) == left && double(r) == right && r != 0 && r != -1)
+			return std::copysign(double(l % r), left);
+	}
+	return std::fmod(left, right);
+}
+
+// Integer arithmetic is exact: a result that would overflow 64 bits, or a division by zero,
+// yields void instead, which callers hand to binaryOperation to report. % and // on doubles
+// truncate like their int versions and fail on a zero divisor too; / follows IEEE 754.
+template<BinaryOperator Op, class T>
+static inline Value typedOperation(T const& left, T const& right) {
+	using enum BinaryOperator;
+	constexpr bool integer = std::is_same_v<T, int64_t>;
+	int64_t result;
+	if constexpr (integer && Op == Add)
+		return __builtin_add_overflow(left, right, &result) ? Value() : Value(result);
+	else if constexpr (integer && Op == Subtract)
+		return __builtin_sub_overflow(left, right, &result) ? Value() : Value(result);
+	else if constexpr (integer && Op == Multiply)
+		return __builtin_mul_overflow(left, right, &result) ? Value() : Value(result);
+	else if constexpr (integer && Op == Divide)
+		return double(left) / double(right);
+	// 64-bit division is several times slower than 32-bit on many x86 cores, so small
+	// non-negative operands take the short one.
+	else if constexpr (integer && Op == DivideRemainder) {
+		if ((uint64_t(left) | uint64_t(right)) >> 32 == 0 && right != 0)
+			return int64_t(uint32_t(left) % uint32_t(right));
+		return right == 0 ? Value() : Value(right == -1 ? 0 : left % right);
+	}
+	else if constexpr (integer && Op == DivideWhole) {
+		if ((uint64_t(left) | uint64_t(right)) >> 32 == 0 && right != 0)
+			return int64_t(uint32_t(left) / uint32_t(right));
+		return right == 0 || (left == INT64_MIN && right == -1) ? Value() : Value(left / right);
+	}
+	else if constexpr (Op == Add)
+		return left + right;
+	else if constexpr (Op == Subtract)
+		return left - right;
+	else if constexpr (Op == Multiply)
+		return left * right;
+	else if constexpr (Op == Divide)
+		return left / right;
+	else if constexpr (Op == DivideRemainder)
+		return right == 0 ? Value() : Value(remainderOf(double(left), double(right)));
+	else if constexpr (Op == DivideWhole)
+		return right == 0 ? Value() : Value(std::trunc(double(left) / double(right)));
+	else if constexpr (Op == Equal)
+		return left == right;
+	else if constexpr (Op == NotEquals)
+		return left != right;
+	else if constexpr (Op == Less)
+		return left < right;
+	else if constexpr (Op == LessEquals)
+		return left <= right;
+	else if constexpr (Op == Greater)
+		return left > right;
+	else if constexpr (Op == GreaterEquals)
+		return left >= right;
+	else if constexpr (Op == AndAnd)
+		return left && right;
+	else
+		return left || right;
+}
+
+// typedOperation on ints for an operator known only at run time; void for the operators ints don't have.
+static Value integerOperation(BinaryOperator op, int64_t left, int64_t right) {
+	using enum BinaryOperator;
+	switch (op) {
+	case Add: return typedOperation<Add, int64_t>(left, right);
+	case Subtract: return typedOperation<Subtract, int64_t>(left, right);
+	case Multiply: return typedOperation<Multiply, int64_t>(left, right);
+	case Divide: return typedOperation<Divide, int64_t>(left, right);
+	case DivideRemainder: return typedOperation<DivideRemainder, int64_t>(left, right);
+	case DivideWhole: return typedOperation<DivideWhole, int64_t>(left, right);
+	case Equal: return typedOperation<Equal, int64_t>(left, right);
+	case NotEquals: return typedOperation<NotEquals, int64_t>(left, right);
+	case Less: return typedOperation<Less, int64_t>(left, right);
+	case LessEquals: return typedOperation<LessEquals, int64_t>(left, right);
+	case Greater: return typedOperation<Greater, int64_t>(left, right);
+	case GreaterEquals: return typedOperation<GreaterEquals, int64_t>(left, right);
+	default: return std::monostate{};
+	}
+}
+
+static size_t checkedIndex(int line, Value const& index, size_t size) {
+	if (index.isInt()) {
+		if (uint64_t(index.asInt()) >= size)
+			runtimeError(line, "index must an integer in range 0..<arraySize");
+		return size_t(index.asInt());
+	}
+	if (!index.isDouble())
+		runtimeError(line, "index must be a number");
+	double number = index.asDouble();
+	if (!(number >= 0 && number < size && int(number) == number))
+		runtimeError(line, "index must an integer in range 0..<arraySize");
+	return size_t(number);
+}
+
+// The number a string starts with after any whitespace, as std::stod reads it: what follows it is ignored.
+static double leadingNumber(int line, std::string const& text) {
+	char const* first = text.data();
+	char const* last = first + text.size();
+	while (first != last && std::isspace(static_cast<unsigned char>(*first)))
+		first++;
+	if (first != last && *first == '+' && last - first > 1 && first[1] != '-')
+		first++;
+	double number;
+	auto [end, error] = std::from_chars(first, last, number);
+	if (error == std::errc::invalid_argument)
+		runtimeError(line, "the string is not a number");
+	if (error == std::errc::result_out_of_range)
+		runtimeError(line, "the number is out of range");
+	return number;
+}
+
+static Value binaryOperation(int line, BinaryOperator op, Value leftVal, Value rightVal) {
+	if(op == BinaryOperator::Index){
+		if(leftVal.isString()) {
+			auto& leftArr = leftVal.asString();
+			if(rightVal.isNumber()){
+				double rightNumber = rightVal.asNumber();
+				if(
+				rightNumber >= 0 &&
+				rightNumber < leftArr.size() && 
+				int(rightNumber) == rightNumber
+				)
+					return std::string{leftArr[rightNumber]};
 			}
-			if(auto leftArr = std::get_if<std::vector<ArrayElement>>(&leftVal)){
-				if(auto rightNumber = std::get_if<double>(&rightVal)){
-					if(
-					*rightNumber >= 0 &&
-					*rightNumber < leftArr->size() && 
-					int(*rightNumber) == *rightNumber
-					)
-						return (*leftArr)[*rightNumber].value;
-					else
-						error("index must an integer in range 0..<arraySize");
-				}else{
-					error("index must be a number");
-				}
-			}else{
-				error("NOT AN ARRAY");
+		}
+		if(leftVal.isArray()){
+			auto& leftArr = leftVal.asArray();
+			return leftArr[checkedIndex(line, rightVal, leftArr.size())].value;
+		}else{
+			runtimeError(line, "NOT AN ARRAY");
+		}
+	}
+	if (leftVal.isInt() && rightVal.isInt()) {
+		int64_t leftNumber = leftVal.asInt(), rightNumber = rightVal.asInt();
+		Value result = integerOperation(op, leftNumber, rightNumber);
+		if (!result.isVoid())
+			return result;
+		if (op == BinaryOperator::AndAnd || op == BinaryOperator::OrOr)
+			runtimeError(line, "Unknown binary operator");
+		runtimeError(line, rightNumber == 0 ? "division by zero" : "integer overflow");
+	}
+	if (leftVal.isNumber()) {
+		if (rightVal.isNumber()) {
+			double leftNumber = leftVal.asNumber(), rightNumber = rightVal.asNumber();
+			switch (op) {
+			case BinaryOperator::NotEquals:
+				return leftNumber != rightNumber;
+			case BinaryOperator::LessEquals:
+				return leftNumber <= rightNumber;
+			case BinaryOperator::GreaterEquals:
+				return leftNumber >= rightNumber;
+			case BinaryOperator::Add:
+				return leftNumber + rightNumber;
+			case BinaryOperator::Subtract:
+				return leftNumber - rightNumber;
+			case BinaryOperator::Multiply:
+				return leftNumber * rightNumber;
+			case BinaryOperator::Divide:
+				return leftNumber / rightNumber;
+			case BinaryOperator::Equal:
+				return leftNumber == rightNumber;
+			case BinaryOperator::Less:
+				return leftNumber < rightNumber;
+			case BinaryOperator::Greater:
+				return leftNumber > rightNumber;
+			case BinaryOperator::DivideRemainder:
+				if (rightNumber == 0)
+					runtimeError(line, "division by zero");
+				return remainderOf(leftNumber, rightNumber);
+			case BinaryOperator::DivideWhole:
+				if (rightNumber == 0)
+					runtimeError(line, "division by zero");
+				return std::trunc(leftNumber / rightNumber);
+			default:
+				runtimeError(line, "Unknown binary operator");
 			}
 		}
-		if (auto leftNumber = std::get_if<double>(&leftVal)) {
-			if (auto rightNumber = std::get_if<double>(&rightVal)) {
-				switch (op) {
-				case BinaryOperator::NotEquals:
-					return *leftNumber != *rightNumber;
-				case BinaryOperator::LessEquals:
-					return *leftNumber <= *rightNumber;
-				case BinaryOperator::GreaterEquals:
-					return *leftNumber >= *rightNumber;
-				case BinaryOperator::Add:
-					return *leftNumber + *rightNumber;
-				case BinaryOperator::Subtract:
-					return *leftNumber - *rightNumber;
-				case BinaryOperator::Multiply:
-					return *leftNumber * *rightNumber;
-				case BinaryOperator::Divide:
-					return *leftNumber / *rightNumber;
-				case BinaryOperator::Equal:
-					return *leftNumber == *rightNumber;
-				case BinaryOperator::Less:
-					return *leftNumber < *rightNumber;
-				case BinaryOperator::Greater:
-					return *leftNumber > *rightNumber;
-				case BinaryOperator::DivideRemainder:
-					return double(int(*leftNumber) % int(*rightNumber));
-				case BinaryOperator::DivideWhole:
-					return double(int(*leftNumber / *rightNumber));
-				default:
-					error("Unknown binary operator");
-				}
+	}else if (leftVal.isString()) {
+		auto& leftString = leftVal.asString();
+		if (rightVal.isString()) {
+			auto& rightString = rightVal.asString();
+
+			switch (op) {
+			case BinaryOperator::NotEquals:
+				return leftString != rightString;
+			case BinaryOperator::Equal:
+				return leftString == rightString;
+			case BinaryOperator::Add:
+				return leftString + rightString;
+			case BinaryOperator::Subtract:
+				return leadingNumber(line, leftString) - leadingNumber(line, rightString);
+			case BinaryOperator::GreaterEquals:
+				return leftString >= rightString;
+			case BinaryOperator::LessEquals:
+				return leftString <= rightString;
+			case BinaryOperator::Less:
+				return leftString < rightString;
+			case BinaryOperator::Greater:
+				return leftString > rightString;
+			default:
+				runtimeError(line, "no such binary operator");
 			}
-		}else if (auto leftString = std::get_if<std::string>(&leftVal)) {
-			if (auto rightString = std::get_if<std::string>(&rightVal))
-
-				switch (op) {
-				case BinaryOperator::NotEquals:
-					return *leftString != *rightString;
-				case BinaryOperator::Equal:
-					return *leftString == *rightString;
-				case BinaryOperator::Add:
-					return *leftString + *rightString;
-				case BinaryOperator::Subtract:
-					return std::stod(*leftString) - std::stod(*rightString);
-				case BinaryOperator::GreaterEquals:
-					return *leftString >= *rightString;
-				case BinaryOperator::LessEquals:
-					return *leftString <= *rightString;
-				case BinaryOperator::Less:
-					return *leftString < *rightString;
-				case BinaryOperator::Greater:
-					return *leftString > *rightString;
-				default:
-					error("no such binary operator");
+		}
+		else if (rightVal.isNumber()) {
+			double rightNumber = rightVal.asNumber();
+			switch (op) {
+			case BinaryOperator::Add: {
+				if (!rightVal.isInt())
+					return leftString + fixedNumber(rightNumber);
+				char digits[32];
+				auto number = formatInteger(digits, rightVal.asInt());
+				std::string joined;
+				joined.reserve(leftString.size() + number.size());
+				joined.append(leftString).append(number);
+				return joined;
+			}
+			case BinaryOperator::Multiply: {
+				// Checked before the conversion to size_t, which is undefined for NaN and out of range doubles.
+				size_t longest = std::string().max_size();
+				if (!(rightNumber >= 0 && rightNumber <= double(longest)) || std::trunc(rightNumber) != rightNumber)
+					runtimeError(line, "Multiplier does not match the expectations given");
+				if (!leftString.empty() && rightNumber > double(longest / leftString.size()))
+					runtimeError(line, "the string would be too long");
+				// Doubling the copied prefix fills the result with O(log n) appends.
+				size_t size = leftString.size() * size_t(rightNumber);
+				std::string repeated;
+				repeated.reserve(size);
+				if (size > 0) {
+					repeated += leftString;
+					while (repeated.size() * 2 <= size)
+						repeated += repeated;
+					repeated.append(repeated, 0, size - repeated.size());
 				}
+				return repeated;
+			}
+			default:
+				runtimeError(line, "no such binary operator for this kinds of values");
+			}
+		}
 
-			else if (auto rightNumber = std::get_if<double>(&rightVal)) {
-				switch (op) {
-				case BinaryOperator::Add:
-					return *leftString + std::to_string(*rightNumber);
-				case BinaryOperator::Multiply:
-					for (int i = 0; i < *rightNumber; i++) {
-						*leftString += *leftString;
-					}
-					return *leftString;
-				default:
-					error("no such binary operator for this kinds of values");
-				}
+	} else if (leftVal.isBool()) {
+		if (rightVal.isBool()) {
+			bool leftBool = leftVal.asBool(), rightBool = rightVal.asBool();
+			if (op == BinaryOperator::AndAnd){
+				return leftBool && rightBool;
+			}else if(op == BinaryOperator::OrOr) {
+				return leftBool || rightBool;
+			}else if (op == BinaryOperator::Equal){
+				return leftBool == rightBool;
+			}else if(op == BinaryOperator::NotEquals){
+				return leftBool != rightBool;
 			}
+		}
+	} else if (leftVal.isArray()) {
+		if (rightVal.isArray()){
+			if (op == BinaryOperator::Add){
+				auto& rightArr = rightVal.asArray();
+				auto& elements = leftVal.mutArray();
+				elements.insert(elements.end(), rightArr.begin(), rightArr.end());
+				if (leftVal.elementType() != rightVal.elementType())
+					leftVal.setElementType(Type::Void);
+				return leftVal;
+			}
+		}else if(rightVal.isNumber()){
+			auto& leftArr = leftVal.asArray();
+			double rightNum = rightVal.asNumber();
 
-		} else if (auto leftBool = std::get_if<bool>(&leftVal)) {
-			if (auto rightBool = std::get_if<bool>(&rightVal)) {
-				if (op == BinaryOperator::AndAnd){
-					return *leftBool && *rightBool;
-				}else if(op == BinaryOperator::OrOr) {
-					return *leftBool || *rightBool;
-				}else if (op == BinaryOperator::Equal){
-					return *leftBool == *rightBool;
-				}else if(op == BinaryOperator::NotEquals){
-					return *leftBool != *rightBool;
+			switch(op){
+			case BinaryOperator::Multiply:{
+				if(rightNum < 0 || int(rightNum) != rightNum)
+					runtimeError(line, "Multiplier does not match the expectations given");
+				std::vector<ArrayElement> multipliedArray;
+				multipliedArray.reserve(leftArr.size() * size_t(rightNum));
+				for(int i = 0; i < rightNum; i++){
+					multipliedArray.insert(multipliedArray.end(), leftArr.begin(), leftArr.end());
 				}
+				return Value(std::move(multipliedArray), leftVal.elementType());
 			}
-		} else if (auto leftArr = std::get_if<std::vector<ArrayElement>>(&leftVal)) {
-			if (auto rightArr = std::get_if<std::vector<ArrayElement>>(&rightVal)){
-				if (op == BinaryOperator::Add){
-					leftArr->insert(leftArr->end(), rightArr->begin(), rightArr->end());
-					return *leftArr;
-				}
-			}else if(auto rightNum = std::get_if<double>(&rightVal)){
-
-				switch(op){
-				case BinaryOperator::Multiply:{
-					if(*rightNum < 0 || int(*rightNum) != *rightNum)
-						error("Multiplier does not match the expectations given");
-					std::vector<ArrayElement> multipliedArray;
-					for(int i = 0; i < *rightNum; i++){
-						multipliedArray.insert(multipliedArray.end(), leftArr->begin(), leftArr->end());
-					}
-					return multipliedArray;
-				}
-				case BinaryOperator::Subtract:{
-					if(*rightNum < 0 || int(*rightNum) != *rightNum || leftArr->size() - *rightNum < 0)
-						error("Subtracter does not match the expectations given");
-					
-					leftArr->resize(leftArr->size() - *rightNum);
-					return *leftArr;
-				}
-				default:
-					error("no such binary operator for these kinds of values");
-				}
+			case BinaryOperator::Subtract:{
+				if(rightNum < 0 || int(rightNum) != rightNum || leftArr.size() - rightNum < 0)
+					runtimeError(line, "Subtracter does not match the expectations given");
+				
+				size_t size = leftArr.size() - rightNum;
+				leftVal.mutArray().resize(size);
+				return leftVal;
+			}
+			default:
+				runtimeError(line, "no such binary operator for these kinds of values");
 			}
 		}
-		
-		error("Both values need to be numbers");
+	}
+	
+	runtimeError(line, "Both values need to be numbers");
+}
+
+// `string s = s + x`: appends to the variable's own string instead of building a new one, so
+// growing a string in a loop is amortized linear. Shared storage is copied once by mutString.
+static void appendInPlace(int line, Value& variable, Value right) {
+	if (right.isString())
+		variable.mutString() += right.asString();
+	else if (right.isDouble())
+		variable.mutString() += fixedNumber(right.asDouble());
+	else if (right.isInt()) {
+		char digits[32];
+		variable.mutString() += formatInteger(digits, right.asInt());
+	}
+	else
+		variable = binaryOperation(line, BinaryOperator::Add, std::move(variable), std::move(right));
+}
+
+// Operands of mixed int and double type, both read as doubles.
+struct Promoted {};
+
+template<class T>
+static bool holds(Value const& val) {
+	if constexpr (std::is_same_v<T, Promoted>)
+		return val.isNumber();
+	else if constexpr (std::is_same_v<T, int64_t>)
+		return val.isInt();
+	else if constexpr (std::is_same_v<T, double>)
+		return val.isDouble();
+	else if constexpr (std::is_same_v<T, bool>)
+		return val.isBool();
+	else
+		return val.isString();
+}
+
+template<class T>
+static decltype(auto) unboxed(Value const& val) {
+	if constexpr (std::is_same_v<T, Promoted>)
+		return val.asNumber();
+	else if constexpr (std::is_same_v<T, int64_t>)
+		return val.asInt();
+	else if constexpr (std::is_same_v<T, double>)
+		return val.asDouble();
+	else if constexpr (std::is_same_v<T, bool>)
+		return val.asBool();
+	else
+		return val.asString();
+}
+
+// Calls visit.template operator()<Op, T>() if operands of the given types have a typed
+// implementation of op (see typedOperation) and returns its result, or R{} if they don't.
+// An int and a double operand are both read as doubles (T = Promoted).
+template<class R, class Visit>
+static R typedDispatch(BinaryOperator op, Type left, Type right, Visit visit) {
+	using enum BinaryOperator;
+	auto pick = [&]<class T, BinaryOperator... Ops>() {
+		R result{};
+		(void)((op == Ops && (result = visit.template operator()<Ops, T>())) || ...);
+		return result;
+	};
+	if (left != right) {
+		if ((left != Type::Int || right != Type::Double) && (left != Type::Double || right != Type::Int))
+			return R{};
+		return pick.template operator()<Promoted, Add, Subtract, Multiply, Divide, DivideRemainder, DivideWhole,
+			Equal, NotEquals, Less, LessEquals, Greater, GreaterEquals>();
+	}
+	switch (left) {
+	case Type::Int:
+		return pick.template operator()<int64_t, Add, Subtract, Multiply, Divide, DivideRemainder, DivideWhole,
+			Equal, NotEquals, Less, LessEquals, Greater, GreaterEquals>();
+	case Type::Double:
+		return pick.template operator()<double, Add, Subtract, Multiply, Divide, DivideRemainder, DivideWhole,
+			Equal, NotEquals, Less, LessEquals, Greater, GreaterEquals>();
+	case Type::String:
+		return pick.template operator()<std::string, Add, Equal, NotEquals, Less, LessEquals, Greater, GreaterEquals>();
+	case Type::Bool:
+		return pick.template operator()<bool, AndAnd, OrOr, Equal, NotEquals>();
+	default:
+		return R{};
+	}
+}
+
+// An inline cache entry: the operation for one operand type pair, computed in place of the
+// left operand. Returns false without touching the operands if they have other types.
+using QuickOperation = bool (*)(Value& leftVal, Value const& rightVal);
+
+template<BinaryOperator Op, class T>
+static bool quickOperation(Value& leftVal, Value const& rightVal) {
+	if (!holds<T>(leftVal) || !holds<T>(rightVal))
+		return false;
+	if constexpr (std::is_same_v<T, Promoted>) {
+		if (leftVal.isInt() == rightVal.isInt())
+			return false;
+	}
+	Value result = typedOperation<Op>(unboxed<T>(leftVal), unboxed<T>(rightVal));
+	if (result.isVoid())
+		return false;
+	leftVal = std::move(result);
+	return true;
+}
+
+struct BinaryExpr : AST {
+	AST *left, *right;
+	BinaryOperator op;
+	Type operands = Type::Void; // what the type checker proved both operands to be, if it specialized the node
+	bool promoted = false;      // or that one is an int and the other a double
+	// Fast path for the operand types seen last; replaced whenever evaluation misses it.
+	// Atomic since pmap workers may evaluate the same node at once; any entry they leave is valid.
+	std::atomic<QuickOperation> quick = nullptr;
+
+	BinaryExpr(int line, AST* left, AST* right, BinaryOperator op) :
+		AST(line), left(left), right(right), op(op) {}
+	Value evaluate(Ctx& ctx) {
+		Value leftVal = left->evaluate(ctx);
+		Value rightVal = right->evaluate(ctx);
+		auto cached = quick.load(std::memory_order_relaxed);
+		if (cached != nullptr && cached(leftVal, rightVal))
+			return leftVal;
+		quick.store(typedDispatch<QuickOperation>(op, leftVal.type(), rightVal.type(), []<BinaryOperator Op, class T>() {
+			return &quickOperation<Op, T>;
+		}), std::memory_order_relaxed);
+		return binaryOperation(line, op, std::move(leftVal), std::move(rightVal));
+	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+};
+
+// A BinaryExpr whose operands the type checker proved to be T (int64_t, double, bool, std::string or Promoted),
+// so it goes straight to the operation instead of through binaryOperation's type dispatch.
+template<BinaryOperator Op, class T>
+struct TypedBinaryExpr : BinaryExpr {
+	TypedBinaryExpr(int line, AST* left, AST* right, BinaryOperator op) : BinaryExpr(line, left, right, op) {
+		if constexpr (std::is_same_v<T, int64_t>)
+			operands = Type::Int;
+		else if constexpr (std::is_same_v<T, double>)
+			operands = Type::Double;
+		else if constexpr (std::is_same_v<T, bool>)
+			operands = Type::Bool;
+		else if constexpr (std::is_same_v<T, std::string>)
+			operands = Type::String;
+		else
+			promoted = true;
+	}
+
+	Value evaluate(Ctx& ctx) {
+		Value leftVal = left->evaluate(ctx);
+		Value rightVal = right->evaluate(ctx);
+		Value result = typedOperation<Op>(unboxed<T>(leftVal), unboxed<T>(rightVal));
+		if (result.isVoid())
+			return binaryOperation(line, op, std::move(leftVal), std::move(rightVal));
+		return result;
 	}
 };
 
 struct PrintExpr : AST {
-	UPAST printee;
+	AST* printee;
 	
-	PrintExpr(int line, UPAST printee) : AST(line), printee(std::move(printee)) {}
+	PrintExpr(int line, AST* printee) : AST(line), printee(printee) {}
 	
 	Value evaluate(Ctx& ctx) {
 		if (printee == nullptr) 
 		{
-			std::cout << '\n';
+			printNewline(*ctx.output);
 			return std::monostate{};
 		}
 		Value val = printee->evaluate(ctx);
-		printValue(val);
+		printValue(*ctx.output, val);
 		
 		return std::monostate{};
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
 
 struct ErrorExpr : AST {
-	UPAST error;
+	AST* error;
 	
-	ErrorExpr(int line, UPAST error) : AST(line), error(std::move(error)) {}
+	ErrorExpr(int line, AST* error) : AST(line), error(error) {}
 	
 	Value evaluate(Ctx& ctx) {
-		Value val = error->evaluate(ctx);
-		std::cerr << "\033[1;31m";
-		throwError(val);
-		std::cout << "\033[0m\n";
-		exit(1);
+		throwValue(line, error->evaluate(ctx));
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
 struct ArraySizeExpr : AST {
-	UPAST arr;
-	ArraySizeExpr(int line, UPAST arr) : AST(line), arr(std::move(arr)){}
+	AST* arr;
+	ArraySizeExpr(int line, AST* arr) : AST(line), arr(arr){}
 	Value evaluate(Ctx& ctx) {
 		
 		auto val = arr->evaluate(ctx);
 		
-		if(auto vector_ptr = std::get_if<std::vector<ArrayElement>>(&val)){
-			return double(vector_ptr->size());
+		if(val.isArray()){
+			return int64_t(val.asArray().size());
 		
-		}else if(auto string_ptr = std::get_if<std::string>(&val)){
-			return double(string_ptr->size());
+		}else if(val.isString()){
+			return int64_t(val.asString().size());
 		}
 		else{
 			error("operand of array size expression must be an array");
 		}
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+};
+
+enum class ArrayOperation {
+	Assign,  // variable.i.j = operand
+	Push,    // push(variable.i, operand)
+	Pop,     // pop(variable.i), yields the removed element
+	Reserve, // reserve(variable.i, operand)
 };
 
+// Updates the array stored in a variable, or one nested in it along the index path, in place:
+// the storage is only copied when another value shares it, so pushing n elements is O(n).
+// For Assign the last index picks the element to replace. Elements stored into an array<T> must conform to T.
+// The variable is whatever its name resolves to, so inside a function that has no local of that name
+// these update the global array itself. A declaration `T name = ...` in a function always makes a
+// local instead, which is why scalars (and strings grown by appendInPlace) never change a global there.
+static Value updateArray(int line, ArrayOperation op, Value& variable, std::span<Value const> indices, Value operand) {
+	auto elementsOf = [line](Value& val) -> std::vector<ArrayElement>& {
+		if (!val.isArray())
+			runtimeError(line, "NOT AN ARRAY");
+		return val.mutArray();
+	};
+	Value* target = &variable;
+	size_t path = op == ArrayOperation::Assign ? indices.size() - 1 : indices.size();
+	for (size_t i = 0; i < path; i++) {
+		auto& arr = elementsOf(*target);
+		target = &arr[checkedIndex(line, indices[i], arr.size())].value;
+	}
+	auto& arr = elementsOf(*target);
+	bool stores = op == ArrayOperation::Assign || op == ArrayOperation::Push;
+	if (stores && target->elementType() != Type::Void && !conforms(operand, target->elementType()))
+		runtimeError(line, "wrong type of array element");
+	switch (op) {
+	case ArrayOperation::Assign:
+		arr[checkedIndex(line, indices.back(), arr.size())].value = std::move(operand);
+		return std::monostate{};
+	case ArrayOperation::Push:
+		arr.push_back(ArrayElement{std::move(operand)});
+		return std::monostate{};
+	case ArrayOperation::Pop: {
+		if (arr.empty())
+			runtimeError(line, "pop from an empty array");
+		Value last = std::move(arr.back().value);
+		arr.pop_back();
+		return last;
+	}
+	case ArrayOperation::Reserve:
+		if (!operand.isNumber())
+			runtimeError(line, "capacity must be a number");
+		if (!(operand.asNumber() >= 0 && operand.asNumber() <= 1e8))
+			runtimeError(line, "capacity must be in range 0..1e8");
+		try {
+			arr.reserve(size_t(operand.asNumber()));
+		}
+		catch (std::bad_alloc const&) {
+			runtimeError(line, "out of memory");
+		}
+		return std::monostate{};
+	}
+	return std::monostate{};
+}
+
+struct ArrayUpdate : AST {
+	ArrayOperation op;
+	VariableExpr* variable;
+	std::span<AST*> indices;
+	AST* operand; // null for Pop
+
+	ArrayUpdate(int line, ArrayOperation op, VariableExpr* variable, std::span<AST*> indices, AST* operand) :
+		AST(line), op(op), variable(variable), indices(indices), operand(operand) {}
+
+	Value evaluate(Ctx& ctx) {
+		size_t base = ctx.stack.size();
+		for (auto index : indices)
+			ctx.stack.push_back(index->evaluate(ctx));
+		Value operandValue = operand != nullptr ? operand->evaluate(ctx) : Value{};
+		// Nothing is pushed once the variable's slot is taken, so the reference stays valid.
+		Value result = updateArray(line, op, variable->storage(ctx), std::span(ctx.stack).subspan(base), std::move(operandValue));
+		ctx.stack.resize(base);
+		return result;
+	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return op != ArrayOperation::Pop; }
+};
 
 struct FuncCallExpression : AST {
-	std::string_view name;
-	std::vector<UPAST> args;
+	Symbol name;
+	std::span<AST*> args;
+	struct FuncDeclaration* func = nullptr; // set by Resolver::link when the name has one declaration
+	std::span<Builtin const> builtins; // the overloads of a builtin of this name, unless a script function has it
+	bool argsChecked = false; // every argument's type was verified by the type checker
 
-	FuncCallExpression(int line, std::string_view name, std::vector<UPAST>&& args) :
-		AST(line), name(name), args(std::move(args)) {}
+	FuncCallExpression(int line, Symbol name, std::span<AST*> args) :
+		AST(line), name(name), args(args) {}
 	
-	Value evaluate(Ctx& ctx) {
-		auto func = ctx.funcs[name];
-		
-		Ctx old_ctx = ctx;
+	Value evaluate(Ctx& ctx);
 
-		if (func.params.size() != args.size())
-			error("Invalid number of arguments ?!");
-		
-		for (int i = 0; i < args.size(); i++){
-			auto arg_value = args[i]->evaluate(ctx);
-			if (type_of_value(arg_value) != func.params[i].type)
-				args[i]->error("wrong type of argument");
-			ctx.values[func.params[i].name] = arg_value;
-		}
-		try{
-			evalStatements(ctx, func.body);
-			ctx = old_ctx;
-		}catch(Value returnValue){
-			if(type_of_value(returnValue) != func.return_type)
-				error("Type missmatch. Return type must match function type");
-			ctx = old_ctx;
-			return returnValue;
-		}
-		
-		if(func.return_type == Type::Void)
-			return std::monostate{};
-		error("Reached end of non-void function");
-	}
+	template<class F>
+	Value invoke(Ctx& ctx, F const& func);
+	template<class F>
+	Value execute(Ctx& ctx, size_t base, F const& func);
+	Value memoized(Ctx& ctx);
+	Value callNative(Ctx& ctx);
+	template<class F>
+	void pushArgs(Ctx& ctx, F const& func);
+	void pushTailArgs(Ctx& ctx);
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
 };
@@ -0,0 +1,219 @@
+#include "typechecker.h"
+
+
+// Whether binaryOperation can run ahead of time: it must not fail or produce unbounded output.
+static bool foldable(BinaryOperator op, Value const& leftVal, Value const& rightVal) {
+	if (leftVal.isInt() && rightVal.isInt())
+		return !integerOperation(op, leftVal.asInt(), rightVal.asInt()).isVoid();
+	if (leftVal.isNumber() && rightVal.isNumber()) {
+		double right = rightVal.asNumber();
+		switch (op) {
+		case BinaryOperator::DivideRemainder:
+		case BinaryOperator::DivideWhole:
+			return right != 0;
+		case BinaryOperator::Index:
+		case BinaryOperator::AndAnd:
+		case BinaryOperator::OrOr:
+			return false;
+		default:
+			return true;
+		}
+	}
+	if (leftVal.isString() && rightVal.isString()) {
+		switch (op) {
+		case BinaryOperator::Add:
+		case BinaryOperator::Equal:
+		case BinaryOperator::NotEquals:
+		case BinaryOperator::Less:
+		case BinaryOperator::LessEquals:
+		case BinaryOperator::Greater:
+		case BinaryOperator::GreaterEquals:
+			return true;
+		default:
+			return false;
+		}
+	}
+	if (leftVal.isString() && rightVal.isNumber())
+		return op == BinaryOperator::Add;
+	if (leftVal.isBool() && rightVal.isBool())
+		return op == BinaryOperator::AndAnd || op == BinaryOperator::OrOr ||
+			op == BinaryOperator::Equal || op == BinaryOperator::NotEquals;
+	return false;
+}
+
+// Folds constant subexpressions and replaces ifs with a constant condition by the branch
+// they take. Runs after the resolver, so removed declarations keep their slots.
+struct Folder {
+	Arena& arena;
+	size_t visited = 0;
+	size_t eliminated = 0;
+
+	Folder(Arena& arena) : arena(arena) {}
+
+	size_t live() const {
+		return visited - eliminated;
+	}
+
+	AST* fold(AST* node) {
+		visited++;
+		return node->fold(*this);
+	}
+
+	static std::optional<Value> constantOf(AST* node) {
+		if (auto integer = dynamic_cast<IntExpr*>(node))
+			return Value(integer->val);
+		if (auto number = dynamic_cast<NumberExpr*>(node))
+			return Value(number->val);
+		if (auto boolean = dynamic_cast<BoolExpr*>(node))
+			return Value(boolean->val);
+		if (auto str = dynamic_cast<StringExpr*>(node))
+			return str->val;
+		return std::nullopt;
+	}
+
+	// Replaces `replaced` folded nodes by a single literal.
+	AST* constant(int line, Value const& val, size_t replaced) {
+		eliminated += replaced - 1;
+		if (val.isBool())
+			return arena.make<BoolExpr>(line, val.asBool());
+		if (val.isString())
+			return arena.make<StringExpr>(line, val.asString());
+		if (val.isInt())
+			return arena.make<IntExpr>(line, val.asInt());
+		return arena.make<NumberExpr>(line, val.asDouble());
+	}
+
+	void foldAll(std::span<AST*> nodes) {
+		for (auto& node : nodes)
+			node = fold(node);
+	}
+
+	// Folds an if in place and returns the number of live nodes left in each branch.
+	std::pair<size_t, size_t> foldIf(IfStatement& statement) {
+		statement.condition = fold(statement.condition);
+		size_t start = live();
+		statement.ifStatements = foldStatements(statement.ifStatements, true);
+		size_t ifLive = live() - start;
+		start = live();
+		statement.elseStatements = foldStatements(statement.elseStatements, true);
+		return {ifLive, live() - start};
+	}
+
+	// The taken branch of a constant if is spliced into the enclosing list. Lists that don't
+	// check statements for void (the top level, for bodies) only take branches that need no check.
+	std::span<AST*> foldStatements(std::span<AST*> statements, bool checkVoid) {
+		std::vector<AST*> folded;
+		for (auto statement : statements) {
+			auto ifStatement = dynamic_cast<IfStatement*>(statement);
+			if (ifStatement == nullptr) {
+				folded.push_back(fold(statement));
+				continue;
+			}
+			visited++;
+			auto [ifLive, elseLive] = foldIf(*ifStatement);
+			auto condition = constantOf(ifStatement->condition);
+			if (!condition || !condition->isBool()) {
+				folded.push_back(ifStatement);
+				continue;
+			}
+			auto taken = condition->asBool() ? ifStatement->ifStatements : ifStatement->elseStatements;
+			if (!checkVoid && !std::ranges::all_of(taken, [](AST* s) { return s->alwaysVoid(); })) {
+				folded.push_back(ifStatement);
+				continue;
+			}
+			eliminated += 2 + (condition->asBool() ? elseLive : ifLive);
+			folded.insert(folded.end(), taken.begin(), taken.end());
+		}
+		if (folded.size() == statements.size()) {
+			std::ranges::copy(folded, statements.begin());
+			return statements;
+		}
+		return arena.list(folded);
+	}
+};
+
+inline AST* AST::fold(Folder&) {
+	return this;
+}
+
+inline AST* ArrayExpr::fold(Folder& f) {
+	f.foldAll(elements);
+	return this;
+}
+
+inline AST* NotExpr::fold(Folder& f) {
+	operand = f.fold(operand);
+	if (auto val = f.constantOf(operand); val && val->isBool())
+		return f.constant(line, !val->asBool(), 2);
+	return this;
+}
+
+inline AST* BinaryExpr::fold(Folder& f) {
+	left = f.fold(left);
+	right = f.fold(right);
+	auto leftVal = f.constantOf(left), rightVal = f.constantOf(right);
+	if (leftVal && rightVal && foldable(op, *leftVal, *rightVal))
+		return f.constant(line, binaryOperation(line, op, *leftVal, *rightVal), 3);
+	return this;
+}
+
+inline AST* PrintExpr::fold(Folder& f) {
+	if (printee != nullptr)
+		printee = f.fold(printee);
+	return this;
+}
+
+inline AST* ErrorExpr::fold(Folder& f) {
+	error = f.fold(error);
+	return this;
+}
+
+inline AST* ArraySizeExpr::fold(Folder& f) {
+	arr = f.fold(arr);
+	return this;
+}
+
+inline AST* FuncCallExpression::fold(Folder& f) {
+	f.foldAll(args);
+	return this;
+}
+
+inline AST* ParallelMapExpr::fold(Folder& f) {
+	array = f.fold(array);
+	return this;
+}
+
+inline AST* ArrayUpdate::fold(Folder& f) {
+	f.foldAll(indices);
+	if (operand != nullptr)
+		operand = f.fold(operand);
+	return this;
+}
+
+inline AST* ForStatement::fold(Folder& f) {
+	variable = f.fold(variable);
+	condition = f.fold(condition);
+	forStatements = f.foldStatements(forStatements, false);
+	return this;
+}
+
+inline AST* IfStatement::fold(Folder& f) {
+	f.foldIf(*this);
+	return this;
+}
+
+inline AST* ReturnStatement::fold(Folder& f) {
+	if (returnee != nullptr)
+		returnee = f.fold(returnee);
+	return this;
+}
+
+inline AST* VariableDeclaration::fold(Folder& f) {
+	expr = f.fold(expr);
+	return this;
+}
+
+inline AST* FuncDeclaration::fold(Folder& f) {
+	body = f.foldStatements(body, true);
+	return this;
+}
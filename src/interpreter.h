@@ -0,0 +1,214 @@
+#include "cache.h"
+#include <chrono>
+
+
+// The interpreter as a library: a host includes this header, compiles each script once into a
+// Program and runs it as often as it likes on an Interpreter, in one long-lived process.
+//
+//	Interpreter interpreter(out, in);
+//	auto program = Program::fromText("print(input())\n", Engine::VM);
+//	interpreter.run(*program);
+//
+// Failures never end the process: compiling and running throw a ScriptError instead.
+//
+// Any number of the host's source files may include this header. Everything defined at namespace
+// scope is inline, one definition for the whole program (the worker pool and the standard builtins
+// among them), except static helpers, which hold no state.
+
+enum class Engine { Tree, VM };
+
+// With --stats, every phase reports its wall time on the stream when it finishes.
+class PhaseTimer {
+	std::ostream* stats;
+	std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+
+public:
+	PhaseTimer(std::ostream* stats) : stats(stats) {}
+
+	void operator()(char const* name) {
+		if (stats == nullptr)
+			return;
+		auto now = std::chrono::steady_clock::now();
+		*stats << name << ": " << std::chrono::duration<double, std::milli>(now - mark).count() << " ms\n";
+		mark = now;
+	}
+};
+
+// A script parsed, resolved, checked, folded and, for the VM, compiled. Each run starts from fresh
+// globals, but runs share the program's inline caches and memo tables, so only one thread may run
+// a program at a time.
+class Program {
+	Arena arena;
+	std::string text; // the source, unless it is mapped from a file
+	std::optional<MappedFile> mapped;
+	std::optional<Lexer> lexer;
+	std::vector<AST*> parsed;
+	std::span<AST*> statements;
+	size_t globalCount = 0;
+	size_t symbolCount = 0;
+	std::optional<Chunk> chunk;
+	std::vector<FuncDeclaration*> pureFunctions;
+	std::ostream* stats;
+	BuiltinRegistry const& builtins;
+
+	Program(Engine engine, std::ostream* stats, BuiltinRegistry const& builtins) :
+		stats(stats), builtins(builtins), engine(engine) {}
+
+	void compile(std::string_view source, PhaseTimer& phase) {
+		lexer.emplace(source, arena, builtins);
+		while (lexer->token == Token{'\n'})
+			lexer->next();
+		while (lexer->token != Token{0})
+			parsed.push_back(parseStatement(*lexer));
+		phase("parse");
+
+		symbolCount = lexer->symbols.size();
+		Resolver resolver(symbolCount);
+		resolver.resolveProgram(parsed);
+		globalCount = resolver.globalTypes.size();
+		phase("resolve");
+
+		TypeChecker checker(arena, resolver);
+		checker.checkStatements(parsed, false);
+		pureFunctions = checker.pureFunctions;
+		phase("check");
+		if (stats)
+			*stats << "specialized nodes: " << checker.specialized << '\n';
+
+		Folder folder(arena);
+		statements = folder.foldStatements(parsed, false);
+		phase("fold");
+		if (stats)
+			*stats << "eliminated nodes: " << folder.eliminated << " of " << folder.visited << '\n';
+
+		if (engine == Engine::VM) {
+			Compiler compiler(builtins);
+			compiler.compileProgram(statements, lexer->tokenLine);
+			chunk = std::move(compiler.chunk);
+			phase("compile");
+		}
+	}
+
+	// Compiling failed other than with a ScriptError: blame the line the lexer got to.
+	[[noreturn]] void rethrowAtLexer() {
+		rethrowAsScriptError(lexer ? lexer->tokenLine : -1);
+	}
+
+public:
+	Engine const engine;
+
+	Program(Program const&) = delete;
+	Program& operator=(Program const&) = delete;
+
+	// The file is memory-mapped while the program lives. --stats figures go to stats, if given.
+	// With a cache, a VM program whose source was compiled before is loaded instead of compiled;
+	// the tree engine needs the parsed program, which the cache doesn't keep. Scripts call the
+	// standard builtins unless given a registry, which must outlive the program.
+	static std::unique_ptr<Program> fromFile(char const* filePath, Engine engine, std::ostream* stats = nullptr,
+			ProgramCache const* cache = nullptr, BuiltinRegistry const& builtins = standardBuiltins()) {
+		PhaseTimer phase(stats);
+		std::unique_ptr<Program> program(new Program(engine, stats, builtins));
+		try {
+			program->mapped.emplace(filePath);
+			std::string_view source(program->mapped->begin(), program->mapped->size());
+			if (cache == nullptr || engine != Engine::VM) {
+				if (cache != nullptr && stats)
+					*stats << "cache: not used, it keeps bytecode for --engine=vm only\n";
+				program->compile(source, phase);
+				return program;
+			}
+			auto key = cache->key(source, builtins);
+			if (auto cached = cache->load(key, source, program->arena)) {
+				program->chunk = std::move(cached->chunk);
+				program->chunk->builtins = &builtins;
+				program->globalCount = cached->globalCount;
+				program->symbolCount = cached->symbolCount;
+				for (auto& proto : program->chunk->functions)
+					if (proto.decl->pure)
+						program->pureFunctions.push_back(proto.decl);
+				phase("load");
+				return program;
+			}
+			program->compile(source, phase);
+			cache->store(key, source, *program->chunk, program->globalCount, program->symbolCount);
+			phase("store");
+		}
+		catch (...) {
+			program->rethrowAtLexer();
+		}
+		return program;
+	}
+
+	static std::unique_ptr<Program> fromText(std::string text, Engine engine, std::ostream* stats = nullptr,
+			BuiltinRegistry const& builtins = standardBuiltins()) {
+		PhaseTimer phase(stats);
+		std::unique_ptr<Program> program(new Program(engine, stats, builtins));
+		program->text = std::move(text);
+		try {
+			program->compile(program->text, phase);
+		}
+		catch (...) {
+			program->rethrowAtLexer();
+		}
+		return program;
+	}
+
+	void run(Ctx& ctx) {
+		PhaseTimer phase(stats);
+		ctx.globals.resize(globalCount);
+		ctx.funcs.resize(symbolCount);
+		if (chunk)
+			VM(*chunk, ctx).run();
+		else {
+			for (auto& i : statements) {
+				try {
+					i->evaluate(ctx);
+				}
+				catch (...) {
+					rethrowAsScriptError(i->line);
+				}
+			}
+		}
+		ctx.output->flush();
+		phase("run");
+		if (stats) {
+			size_t hits = 0, misses = 0;
+			for (auto func : pureFunctions) {
+				hits += func->memo->hits;
+				misses += func->memo->misses;
+			}
+			*stats << "memo hits: " << hits << ", misses: " << misses << '\n';
+		}
+	}
+};
+
+// Runs programs with its own output and input: stdout and stdin, or the streams a host gives.
+// Interpreters share nothing, so different threads may each run one at once.
+class Interpreter {
+	Output output;
+	InputReader input;
+
+public:
+	Interpreter() = default;
+	Interpreter(std::ostream& out, std::istream& in) : output(out), input(in) {}
+
+	// Flush the output after every print, not only when the buffer is full or the run ends.
+	void unbuffered(bool on) {
+		output.unbuffered = on;
+	}
+
+	// Everything printed is flushed before this returns or throws the run's ScriptError. Input
+	// continues where the previous run stopped reading.
+	void run(Program& program) {
+		Ctx ctx;
+		ctx.output = &output;
+		ctx.input = &input;
+		try {
+			program.run(ctx);
+		}
+		catch (...) {
+			output.flush();
+			rethrowAsScriptError(-1);
+		}
+	}
+};
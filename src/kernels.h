@@ -0,0 +1,365 @@
+#include "Lexer.h"
+#include <ranges>
+
+
+// Native kernels behind the array builtins registered in builtins.h. They read the element
+// storage directly: ArrayElement is a single Value, so an array<double> is a plain run of doubles
+// and an array<int> a run of IntTag words, except for the rare ints boxed on the heap. Each kernel
+// is compiled for AVX2 and for the baseline instruction set; the loader picks what the CPU supports.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KERNEL __attribute__((target_clones("avx2", "default")))
+// The vector helpers are always inlined, so the calling convention GCC warns about is never used.
+#pragma GCC diagnostic ignored "-Wpsabi"
+#else
+#define KERNEL
+#endif
+
+typedef double Doubles __attribute__((vector_size(32)));
+typedef int64_t Words __attribute__((vector_size(32)));
+constexpr size_t Lanes = sizeof(Doubles) / sizeof(double);
+
+struct ElementWords {
+	static constexpr int64_t TagMask = int64_t(Value::TagMask);
+	static constexpr int64_t IntTag = int64_t(Value::IntTag);
+	static constexpr int64_t PayloadMask = int64_t(Value::PayloadMask);
+	static constexpr int64_t SignBit = int64_t(1) << 47;
+	static constexpr uint64_t CanonicalNaN = Value::CanonicalNaN;
+
+	static uint64_t word(Value const& value) {
+		return value.bits;
+	}
+	static bool boxed(Value const& value) {
+		return value.isObject();
+	}
+
+	// ArrayElement and Value are standard layout with the bits as their first member.
+	static uint64_t const* of(std::vector<ArrayElement> const& elements) {
+		return reinterpret_cast<uint64_t const*>(elements.data());
+	}
+	static uint64_t* of(std::vector<ArrayElement>& elements) {
+		return reinterpret_cast<uint64_t*>(elements.data());
+	}
+};
+
+[[gnu::always_inline]] inline Doubles loadDoubles(uint64_t const* words) {
+	Doubles v;
+	__builtin_memcpy(&v, words, sizeof v);
+	return v;
+}
+
+[[gnu::always_inline]] inline Words loadWords(uint64_t const* words) {
+	Words v;
+	__builtin_memcpy(&v, words, sizeof v);
+	return v;
+}
+
+[[gnu::always_inline]] inline bool anyLane(Words const& mask) {
+	return (mask[0] | mask[1] | mask[2] | mask[3]) != 0;
+}
+
+// Sign-extends the 48-bit payloads of inline ints.
+[[gnu::always_inline]] inline Words payloads(Words const& v) {
+	return ((v & ElementWords::PayloadMask) ^ ElementWords::SignBit) - ElementWords::SignBit;
+}
+
+[[gnu::always_inline]] inline Words boxedLanes(Words const& v) {
+	return (v & ElementWords::TagMask) != ElementWords::IntTag;
+}
+
+static int64_t payload(uint64_t word) {
+	return int64_t(word << 16) >> 16;
+}
+
+static bool boxedWord(uint64_t word) {
+	return (int64_t(word) & ElementWords::TagMask) != ElementWords::IntTag;
+}
+
+static double wordDouble(uint64_t word) {
+	return std::bit_cast<double>(word);
+}
+
+// Four independent accumulators keep the adds from waiting on each other. The sum is
+// associated differently from a loop over the elements, so it can differ in the last bits.
+KERNEL static double sumDoubles(uint64_t const* words, size_t n) {
+	Doubles acc[4] = {};
+	size_t i = 0;
+	for (; i + 4 * Lanes <= n; i += 4 * Lanes)
+		for (size_t k = 0; k < 4; k++)
+			acc[k] += loadDoubles(words + i + k * Lanes);
+	Doubles total = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+	double sum = (total[0] + total[1]) + (total[2] + total[3]);
+	for (; i < n; i++)
+		sum += wordDouble(words[i]);
+	return sum;
+}
+
+KERNEL static double dotDoubles(uint64_t const* left, uint64_t const* right, size_t n) {
+	Doubles acc[2] = {};
+	size_t i = 0;
+	for (; i + 2 * Lanes <= n; i += 2 * Lanes)
+		for (size_t k = 0; k < 2; k++)
+			acc[k] += loadDoubles(left + i + k * Lanes) * loadDoubles(right + i + k * Lanes);
+	Doubles total = acc[0] + acc[1];
+	double sum = (total[0] + total[1]) + (total[2] + total[3]);
+	for (; i < n; i++)
+		sum += wordDouble(left[i]) * wordDouble(right[i]);
+	return sum;
+}
+
+// A NaN anywhere makes the result NaN. n must not be 0.
+template<bool Max>
+[[gnu::always_inline]] inline double extremeDoubles(uint64_t const* words, size_t n) {
+	Doubles best = Doubles{} + wordDouble(words[0]);
+	Words nan = {};
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes) {
+		Doubles v = loadDoubles(words + i);
+		nan |= v != v;
+		if constexpr (Max)
+			best = v > best ? v : best;
+		else
+			best = v < best ? v : best;
+	}
+	double result = best[0];
+	for (size_t k = 1; k < Lanes; k++)
+		result = Max ? std::max(result, best[k]) : std::min(result, best[k]);
+	for (; i < n; i++) {
+		double v = wordDouble(words[i]);
+		nan[0] |= v != v;
+		result = Max ? std::max(result, v) : std::min(result, v);
+	}
+	return anyLane(nan) ? wordDouble(ElementWords::CanonicalNaN) : result;
+}
+
+KERNEL static double minDoubles(uint64_t const* words, size_t n) {
+	return extremeDoubles<false>(words, n);
+}
+
+KERNEL static double maxDoubles(uint64_t const* words, size_t n) {
+	return extremeDoubles<true>(words, n);
+}
+
+// Multiplies in place; NaN products are stored as the one NaN a Value holds.
+KERNEL static void scaleDoubles(uint64_t* words, size_t n, double factor) {
+	Doubles nan = Doubles{} + wordDouble(ElementWords::CanonicalNaN);
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes) {
+		Doubles v = loadDoubles(words + i) * factor;
+		v = v == v ? v : nan;
+		__builtin_memcpy(words + i, &v, sizeof v);
+	}
+	for (; i < n; i++) {
+		double v = wordDouble(words[i]) * factor;
+		words[i] = v == v ? std::bit_cast<uint64_t>(v) : ElementWords::CanonicalNaN;
+	}
+}
+
+// The index of the first element equal to the needle, or n.
+KERNEL static size_t findDouble(uint64_t const* words, size_t n, double needle) {
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		if (anyLane(loadDoubles(words + i) == needle))
+			break;
+	for (; i < n; i++)
+		if (wordDouble(words[i]) == needle)
+			return i;
+	return n;
+}
+
+// The same for a word compared bit for bit, which finds inline ints.
+KERNEL static size_t findWord(uint64_t const* words, size_t n, uint64_t needle) {
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		if (anyLane(loadWords(words + i) == int64_t(needle)))
+			break;
+	for (; i < n; i++)
+		if (words[i] == needle)
+			return i;
+	return n;
+}
+
+// Int kernels work on blocks of inline ints. Payloads are at most 2^47 in magnitude, so the lanes
+// of a block's sum can't overflow; blocks holding a boxed int take the checked scalar path.
+constexpr size_t IntBlock = 1 << 14;
+
+KERNEL static bool sumInlineInts(uint64_t const* words, size_t n, int64_t& sum) {
+	Words acc[2] = {}, boxed = {};
+	size_t i = 0;
+	for (; i + 2 * Lanes <= n; i += 2 * Lanes)
+		for (size_t k = 0; k < 2; k++) {
+			Words v = loadWords(words + i + k * Lanes);
+			boxed |= boxedLanes(v);
+			acc[k] += payloads(v);
+		}
+	Words total = acc[0] + acc[1];
+	sum = (total[0] + total[1]) + (total[2] + total[3]);
+	for (; i < n; i++) {
+		boxed[0] |= boxedWord(words[i]);
+		sum += payload(words[i]);
+	}
+	return !anyLane(boxed);
+}
+
+template<bool Max>
+[[gnu::always_inline]] inline bool extremeInlineInts(uint64_t const* words, size_t n, int64_t& result) {
+	Words best = Words{} + payload(words[0]), boxed = {};
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes) {
+		Words raw = loadWords(words + i);
+		boxed |= boxedLanes(raw);
+		Words v = payloads(raw);
+		if constexpr (Max)
+			best = v > best ? v : best;
+		else
+			best = v < best ? v : best;
+	}
+	result = best[0];
+	for (size_t k = 1; k < Lanes; k++)
+		result = Max ? std::max(result, best[k]) : std::min(result, best[k]);
+	for (; i < n; i++) {
+		boxed[0] |= boxedWord(words[i]);
+		result = Max ? std::max(result, payload(words[i])) : std::min(result, payload(words[i]));
+	}
+	return !anyLane(boxed);
+}
+
+KERNEL static bool minInlineInts(uint64_t const* words, size_t n, int64_t& result) {
+	return extremeInlineInts<false>(words, n, result);
+}
+
+KERNEL static bool maxInlineInts(uint64_t const* words, size_t n, int64_t& result) {
+	return extremeInlineInts<true>(words, n, result);
+}
+
+static Value intSum(int line, std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	auto words = ElementWords::of(elements);
+	int64_t sum = 0;
+	for (size_t i = 0; i < elements.size(); i += IntBlock) {
+		size_t count = std::min(IntBlock, elements.size() - i);
+		int64_t block;
+		if (!sumInlineInts(words + i, count, block)) {
+			block = 0;
+			for (size_t k = i; k < i + count; k++)
+				if (__builtin_add_overflow(block, elements[k].value.asInt(), &block))
+					runtimeError(line, "integer overflow");
+		}
+		if (__builtin_add_overflow(sum, block, &sum))
+			runtimeError(line, "integer overflow");
+	}
+	return sum;
+}
+
+static Value doubleSum(int, std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	return sumDoubles(ElementWords::of(elements), elements.size());
+}
+
+template<bool Max>
+static Value intExtreme(int line, std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	if (elements.empty())
+		runtimeError(line, "empty array");
+	int64_t result;
+	if ((Max ? maxInlineInts : minInlineInts)(ElementWords::of(elements), elements.size(), result))
+		return result;
+	auto values = elements | std::views::transform([](auto& e) { return e.value.asInt(); });
+	return Max ? std::ranges::max(values) : std::ranges::min(values);
+}
+
+template<bool Max>
+static Value doubleExtreme(int line, std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	if (elements.empty())
+		runtimeError(line, "empty array");
+	return (Max ? maxDoubles : minDoubles)(ElementWords::of(elements), elements.size());
+}
+
+static std::pair<std::vector<ArrayElement> const&, std::vector<ArrayElement> const&> sameSize(int line, std::span<Value> args) {
+	auto& left = args[0].asArray();
+	auto& right = args[1].asArray();
+	if (left.size() != right.size())
+		runtimeError(line, "arrays must have the same size");
+	return {left, right};
+}
+
+// Ints have no checked vector multiply, so their dot product stays scalar.
+static Value intDot(int line, std::span<Value> args) {
+	auto [left, right] = sameSize(line, args);
+	int64_t sum = 0, product;
+	for (size_t i = 0; i < left.size(); i++)
+		if (__builtin_mul_overflow(left[i].value.asInt(), right[i].value.asInt(), &product) || __builtin_add_overflow(sum, product, &sum))
+			runtimeError(line, "integer overflow");
+	return sum;
+}
+
+static Value doubleDot(int line, std::span<Value> args) {
+	auto [left, right] = sameSize(line, args);
+	return dotDoubles(ElementWords::of(left), ElementWords::of(right), left.size());
+}
+
+// Scaling and sorting work on the argument's own storage, which is only copied if shared.
+static Value intScale(int line, std::span<Value> args) {
+	int64_t factor = args[1].asInt(), product;
+	for (auto& element : args[0].mutArray()) {
+		if (__builtin_mul_overflow(element.value.asInt(), factor, &product))
+			runtimeError(line, "integer overflow");
+		element.value = product;
+	}
+	return std::move(args[0]);
+}
+
+static Value doubleScale(int, std::span<Value> args) {
+	auto& elements = args[0].mutArray();
+	scaleDoubles(ElementWords::of(elements), elements.size(), args[1].asDouble());
+	return std::move(args[0]);
+}
+
+static Value position(size_t index, size_t size) {
+	return index < size ? int64_t(index) : int64_t(-1);
+}
+
+// Boxed ints and strings are compared by content, one element at a time.
+static Value scalarIndexOf(std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	auto found = std::ranges::find_if(elements, [&](auto& e) { return e.value.identical(args[1]); });
+	return position(size_t(found - elements.begin()), elements.size());
+}
+
+static Value intIndexOf(int, std::span<Value> args) {
+	if (ElementWords::boxed(args[1]))
+		return scalarIndexOf(args);
+	auto& elements = args[0].asArray();
+	return position(findWord(ElementWords::of(elements), elements.size(), ElementWords::word(args[1])), elements.size());
+}
+
+static Value doubleIndexOf(int, std::span<Value> args) {
+	auto& elements = args[0].asArray();
+	return position(findDouble(ElementWords::of(elements), elements.size(), args[1].asDouble()), elements.size());
+}
+
+static Value stringIndexOf(int, std::span<Value> args) {
+	return scalarIndexOf(args);
+}
+
+template<class Less>
+static Value sorted(std::span<Value> args, Less less) {
+	std::ranges::sort(args[0].mutArray(), less);
+	return std::move(args[0]);
+}
+
+static Value intSort(int, std::span<Value> args) {
+	return sorted(args, [](auto& a, auto& b) { return a.value.asInt() < b.value.asInt(); });
+}
+
+// NaNs sort last.
+static Value doubleSort(int, std::span<Value> args) {
+	return sorted(args, [](auto& a, auto& b) {
+		double x = a.value.asDouble(), y = b.value.asDouble();
+		return x < y || (y != y && x == x);
+	});
+}
+
+static Value stringSort(int, std::span<Value> args) {
+	return sorted(args, [](auto& a, auto& b) { return a.value.asString() < b.value.asString(); });
+}
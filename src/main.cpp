@@ -1,25 +1,77 @@
-#include "parseExpressions.h"
+#include "interpreter.h"
 
 
+[[noreturn]] void usage() {
+	std::cerr << "usage: ciktor [--engine=vm|tree] [--stats] [--unbuffered] [--threads=n] [--no-cache] file" << '\n';
+	std::exit(1);
+}
+
+// Reports a failed run the way the interpreter always has: the line and the message in red on
+// stderr; a thrown value's reset code follows everything else on stdout.
+static void report(ScriptError const& error, char const* filePath) {
+	switch (error.kind) {
+	case ScriptError::Kind::Error:
+		if (error.line < 0)
+			std::cerr << filePath << ": " << makeStringRed(error.what()) << '\n';
+		else
+			std::cerr << error.line + 1 << ": " << makeStringRed(error.what()) << '\n';
+		break;
+	case ScriptError::Kind::Thrown:
+		std::cerr << "\033[1;31m" << error.what();
+		std::cout << "\033[0m\n";
+		break;
+	case ScriptError::Kind::Exit:
+		break;
+	}
+}
+
 int main(int argc, char **argv)
 {
-	if (argc != 2) {
-		std::cerr << "usage: ciktor file" << '\n';
-		std::exit(1);
+	const char* filePath = nullptr;
+	bool useVM = true; // the bytecode VM outruns the tree walker, which stays for comparison
+	bool stats = false;
+	bool cached = true;
+	Interpreter interpreter;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i] == "--engine=vm"sv)
+			useVM = true;
+		else if (argv[i] == "--engine=tree"sv)
+			useVM = false;
+		else if (argv[i] == "--stats"sv)
+			stats = true;
+		else if (argv[i] == "--unbuffered"sv)
+			interpreter.unbuffered(true);
+		else if (argv[i] == "--no-cache"sv)
+			cached = false;
+		else if (std::string_view(argv[i]).starts_with("--threads=")) {
+			int threads = atoi(argv[i] + 10);
+			if (threads < 1)
+				usage();
+			pool.resize(threads);
+		}
+		else if (filePath == nullptr)
+			filePath = argv[i];
+		else
+			usage();
+	}
+	if (filePath == nullptr)
+		usage();
+	std::ios::sync_with_stdio(false);
+
+	// VM programs are kept in ~/.cache/ciktor, so running an unchanged script again skips compiling it.
+	// Only --engine=tree runs go without.
+	std::optional<ProgramCache> cache;
+	if (auto directory = ProgramCache::defaultDirectory(); cached && !directory.empty())
+		cache.emplace(std::move(directory));
+	try {
+		auto program = Program::fromFile(filePath, useVM ? Engine::VM : Engine::Tree, stats ? &std::cerr : nullptr,
+			cache ? &*cache : nullptr);
+		interpreter.run(*program);
+	}
+	catch (ScriptError const& error) {
+		report(error, filePath);
+		return 1;
 	}
-	Lexer lx(argv[1]);
-	
-	std::vector<UPAST> statements;
-	while(lx.token != Token{0})
-		statements.push_back(parseStatement(lx));
-	
-	Ctx ctx;
-	ctx.values["true"] = true;
-	ctx.values["false"] = false;
-
-	for (auto& i : statements)
-		i->evaluate(ctx);
-	
 	return 0;
 }
 
@@ -1,201 +1,246 @@
 #include "declarations.h"
 
 
-std::string_view parseName(Lexer& lx) {
-	if (auto psv = std::get_if<std::string_view>(&lx.token)) {
-		auto sv = *psv;
+inline Symbol parseName(Lexer& lx) {
+	if (auto psym = std::get_if<Symbol>(&lx.token)) {
+		auto sym = *psym;
 		lx.next();
-		return sv;
+		return sym;
 	}
 	else {
 		lx.error("Expected a name");
 	}
 }
 
-UPAST parseExpression(Lexer& lx);
-UPAST parsePrimaryExpression(Lexer& lx) {
+inline AST* parseExpression(Lexer& lx);
+inline AST* parsePrimaryExpression(Lexer& lx);
+
+// The array argument of push, pop and reserve: a variable, optionally indexed into.
+inline std::pair<VariableExpr*, std::span<AST*>> parseArrayPlace(Lexer& lx) {
+	int line = lx.tokenLine;
+	auto variable = lx.arena.make<VariableExpr>(line, parseName(lx));
+	std::vector<AST*> indices;
+	while (lx.token == Token{ '.' }) {
+		lx.next();
+		indices.push_back(parsePrimaryExpression(lx));
+	}
+	return {variable, lx.arena.list(indices)};
+}
+
+inline AST* parsePrimaryExpression(Lexer& lx) {
 		int line = lx.tokenLine;
 	if (lx.token == Token{ '!' }) {
 		lx.next();
-		return std::make_unique<NotExpr>(line, parsePrimaryExpression(lx));
+		return lx.arena.make<NotExpr>(line, parsePrimaryExpression(lx));
 	}
 	if(lx.token == Token{'['}){
 		lx.next();
-		std::vector<UPAST> args;
+		std::vector<AST*> args;
 		if (lx.token != Token(']')){
 		next_element:
-			args.push_back(UPAST{parseExpression(lx)});
+			args.push_back(parseExpression(lx));
 			if(lx.token == Token{','}){
 				lx.next();
 				goto next_element;
 			}
 		}
 		lx.expect(']');
-		return std::make_unique<ArrayExpr>(line, std::move(args));
+		return lx.arena.make<ArrayExpr>(line, lx.arena.list(args));
+	}
+	if (auto pn = std::get_if<int64_t>(&lx.token)) {
+		auto n = *pn;
+		lx.next();
+		return lx.arena.make<IntExpr>(line, n);
 	}
 	if (auto pn = std::get_if<double>(&lx.token)) {
 		auto n = *pn;
 		lx.next();
-		return std::make_unique<NumberExpr>(line, n);
+		return lx.arena.make<NumberExpr>(line, n);
 	}
-	if (auto pstr = std::get_if<std::string>(&lx.token)) {
+	if (auto pstr = std::get_if<std::string_view>(&lx.token)) {
 		auto str = *pstr;
 		lx.next();
-		return std::make_unique<StringExpr>(line, str);
+		return lx.arena.make<StringExpr>(line, std::string(str));
 	}
-	if (lx.token == Token{ "input"sv }) {
+	if (lx.token == Token{ Keyword::True } || lx.token == Token{ Keyword::False }) {
+		bool val = lx.token == Token{ Keyword::True };
+		lx.next();
+		return lx.arena.make<BoolExpr>(line, val);
+	}
+	if (lx.token == Token{ Keyword::Input } || lx.token == Token{ Keyword::ReadAll } || lx.token == Token{ Keyword::ReadLines }) {
+		auto mode = lx.token == Token{ Keyword::Input } ? InputMode::Line
+			: lx.token == Token{ Keyword::ReadAll } ? InputMode::All : InputMode::Lines;
 		lx.next();
         lx.expect('(');
         lx.expect(')');
-		return std::make_unique<InputExpr>(line);
+		return lx.arena.make<InputExpr>(line, mode);
+	}
+	if (lx.token == Token{ Keyword::Exit }) {
+		lx.next();
+		lx.expect('(');
+		lx.expect(')');
+		return lx.arena.make<exitExpr>(line);
+	}
+	if (lx.token == Token{ Keyword::Pop }) {
+		lx.next();
+		lx.expect('(');
+		auto [variable, indices] = parseArrayPlace(lx);
+		lx.expect(')');
+		return lx.arena.make<ArrayUpdate>(line, ArrayOperation::Pop, variable, indices, nullptr);
 	}
-	if (lx.token == Token{ "exit"sv }) {
+	if (lx.token == Token{ Keyword::Pmap }) {
 		lx.next();
 		lx.expect('(');
+		auto name = parseName(lx);
+		lx.expect(',');
+		auto array = parseExpression(lx);
 		lx.expect(')');
-		return std::make_unique<exitExpr>(line);
+		auto call = lx.arena.make<FuncCallExpression>(line, name, std::span<AST*>());
+		return lx.arena.make<ParallelMapExpr>(line, call, array);
 	}
-	if (auto pstrv = std::get_if<std::string_view>(&lx.token)) {
-		auto str = *pstrv;
+	if (auto psym = std::get_if<Symbol>(&lx.token)) {
+		auto sym = *psym;
 		lx.next();
 		if(lx.token == Token{'('}) {
 			lx.next();
-			std::vector<UPAST> args;
+			std::vector<AST*> args;
 			if (lx.token != Token(')')){
 			next_arg:
-				args.push_back(UPAST{parseExpression(lx)});
+				args.push_back(parseExpression(lx));
 				if(lx.token == Token{','}){
 					lx.next();
 					goto next_arg;
 				}
 			}
 			lx.expect(')');
-			return std::make_unique<FuncCallExpression>(line, str, std::move(args));
+			auto call = lx.arena.make<FuncCallExpression>(line, sym, lx.arena.list(args));
+			call->builtins = lx.builtins.named(lx.symbols.names[sym.id]);
+			return call;
 		}
-		return std::make_unique<VariableExpr>(line, str);
+		return lx.arena.make<VariableExpr>(line, sym);
 	}
 	if (lx.token == Token {'('}){
 		lx.next();
-		UPAST expr = parseExpression(lx);
+		AST* expr = parseExpression(lx);
 		lx.expect(')');
 		return expr;
 	}
 	lx.error("expected an expression");
 }
-UPAST parseIndexExpression(Lexer& lx) {
-	UPAST left = parsePrimaryExpression(lx);
+inline AST* parseIndexExpression(Lexer& lx) {
+	AST* left = parsePrimaryExpression(lx);
 	while (true) {
 		if (lx.token == Token{ '.' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parsePrimaryExpression(lx), BinaryOperator::Index);
+			left = lx.arena.make<BinaryExpr>(line, left, parsePrimaryExpression(lx), BinaryOperator::Index);
 		}
 		else {
 			return left;
 		}
 	}
 }
-UPAST parsePostfixExpression(Lexer& lx) {
-	UPAST pastExpr = parseIndexExpression(lx);
+inline AST* parsePostfixExpression(Lexer& lx) {
+	AST* pastExpr = parseIndexExpression(lx);
 	
 	if(lx.token == Token{'?'}) {
 		int line = lx.tokenLine;
 		lx.next();
-		return std::make_unique<ArraySizeExpr>(line, std::move(pastExpr));
+		return lx.arena.make<ArraySizeExpr>(line, pastExpr);
 	}else{
 		return pastExpr;
 	}
 }
 
 
-UPAST parseMultiplyDivideExpression(Lexer& lx) {
-	UPAST left = parsePostfixExpression(lx);
+inline AST* parseMultiplyDivideExpression(Lexer& lx) {
+	AST* left = parsePostfixExpression(lx);
 	while (true) {
 		if (lx.token == Token{ '*' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseIndexExpression(lx), BinaryOperator::Multiply);
+			left = lx.arena.make<BinaryExpr>(line, left, parseIndexExpression(lx), BinaryOperator::Multiply);
 		}
 		else if (lx.token == Token{ '/' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseIndexExpression(lx), BinaryOperator::Divide);
+			left = lx.arena.make<BinaryExpr>(line, left, parseIndexExpression(lx), BinaryOperator::Divide);
 		}
 		else if (lx.token == Token{ '%' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseIndexExpression(lx), BinaryOperator::DivideRemainder);
+			left = lx.arena.make<BinaryExpr>(line, left, parseIndexExpression(lx), BinaryOperator::DivideRemainder);
 		}
 		else if (lx.token == Token{ExtendedToken::SlashSlash}) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseIndexExpression(lx), BinaryOperator::DivideWhole);
+			left = lx.arena.make<BinaryExpr>(line, left, parseIndexExpression(lx), BinaryOperator::DivideWhole);
 		}
 		else {
 			return left;
 		}
 	}
 }
-UPAST parseAddSubtractExpression(Lexer& lx) {
-	UPAST left = parseMultiplyDivideExpression(lx);
+inline AST* parseAddSubtractExpression(Lexer& lx) {
+	AST* left = parseMultiplyDivideExpression(lx);
 	while (true) {
 		if (lx.token == Token{ '+' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseMultiplyDivideExpression(lx), BinaryOperator::Add);
+			left = lx.arena.make<BinaryExpr>(line, left, parseMultiplyDivideExpression(lx), BinaryOperator::Add);
 		}
 		else if (lx.token == Token{ '-' }) {
 			int line = lx.tokenLine;
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseMultiplyDivideExpression(lx), BinaryOperator::Subtract);
+			left = lx.arena.make<BinaryExpr>(line, left, parseMultiplyDivideExpression(lx), BinaryOperator::Subtract);
 		}
 		else {
 			return left;
 		}
 	}
 }
-UPAST parseCompareExpression(Lexer& lx) {
-	UPAST left = parseAddSubtractExpression(lx);
+inline AST* parseCompareExpression(Lexer& lx) {
+	AST* left = parseAddSubtractExpression(lx);
 	int line = lx.tokenLine;
 	if (lx.token == Token{ExtendedToken::EqualsEquals}) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::Equal);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::Equal);
 	}
 	else if(lx.token == Token{ExtendedToken::NotEquals}) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::NotEquals);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::NotEquals);
 	}
 	else if(lx.token == Token{ExtendedToken::LessEquals}) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::LessEquals);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::LessEquals);
 	}
 	else if(lx.token == Token{ExtendedToken::GreaterEquals}) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::GreaterEquals);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::GreaterEquals);
 	}
 	else if (lx.token == Token{ '<' }) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::Less);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::Less);
 	}
 	else if (lx.token == Token{ '>' }) {
 		lx.next();
-		return std::make_unique<BinaryExpr>(line, std::move(left), parseAddSubtractExpression(lx), BinaryOperator::Greater);
+		return lx.arena.make<BinaryExpr>(line, left, parseAddSubtractExpression(lx), BinaryOperator::Greater);
 	}
 	else {
 		return left;
 	}
 }
-UPAST parseExpression(Lexer& lx){
-	UPAST left = parseCompareExpression(lx);
+inline AST* parseExpression(Lexer& lx){
+	AST* left = parseCompareExpression(lx);
 	while (true) {
 		int line = lx.tokenLine;
 		if (lx.token == Token{ExtendedToken::OrOr}) {
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseCompareExpression(lx), BinaryOperator::OrOr);
+			left = lx.arena.make<BinaryExpr>(line, left, parseCompareExpression(lx), BinaryOperator::OrOr);
 		}
 		else if (lx.token == Token{ExtendedToken::AndAnd}) {
 			lx.next();
-			left = std::make_unique<BinaryExpr>(line, std::move(left), parseCompareExpression(lx), BinaryOperator::AndAnd);
+			left = lx.arena.make<BinaryExpr>(line, left, parseCompareExpression(lx), BinaryOperator::AndAnd);
 		}
 		else {
 			return left;
@@ -203,47 +248,58 @@ UPAST parseExpression(Lexer& lx){
 	}
 }
 
-std::optional<Type> parseType(Lexer& lx) {
-	if (lx.token == Token{ "void"sv }) {
+inline std::optional<Type> parseType(Lexer& lx) {
+	if (lx.token == Token{ Keyword::Void }) {
 		lx.next();
 		return Type::Void;
 	}
-	if (lx.token == Token{ "array"sv }){
+	if (lx.token == Token{ Keyword::Array }){
+		lx.next();
+		if (lx.token != Token{'<'})
+			return Type::Array;
 		lx.next();
-		return Type::Array;
+		auto element = parseType(lx);
+		if (!element || *element == Type::Void || isArrayType(*element))
+			lx.error("arrays can only hold bool, int, double or string");
+		lx.expect('>');
+		return arrayOf(*element);
 	}
-	if (lx.token == Token{ "bool"sv }) {
+	if (lx.token == Token{ Keyword::Bool }) {
 		lx.next();
 		return Type::Bool;
 	}
-	if (lx.token == Token{ "int"sv } || lx.token == Token{ "double"sv }) {
+	if (lx.token == Token{ Keyword::Int }) {
+		lx.next();
+		return Type::Int;
+	}
+	if (lx.token == Token{ Keyword::Double }) {
 		lx.next();
 		return Type::Double;
 	}
-	if (lx.token == Token{ "string"sv }) {
+	if (lx.token == Token{ Keyword::String }) {
 		lx.next();
 		return Type::String;
 	}
 	return std::nullopt;
 }
 
-UPAST parseStatement(Lexer&);
-UPAST parseIf(Lexer& lx){
+inline AST* parseStatement(Lexer&);
+inline AST* parseIf(Lexer& lx){
 	int line = lx.tokenLine;
 	lx.next();
 	auto con = parseExpression(lx);
 	lx.expect('{');
 	while (lx.token == Token{'\n'})
 		lx.next();
-	std::vector<UPAST> ifStatements;
-	std::vector<UPAST> elseStatements;
+	std::vector<AST*> ifStatements;
+	std::vector<AST*> elseStatements;
 	while (lx.token != Token{ '}' }) {
 		ifStatements.emplace_back(parseStatement(lx));
 	}
 	lx.next();
-	if (lx.token == Token{ "else"sv }) {
+	if (lx.token == Token{ Keyword::Else }) {
 		lx.next();
-		if (lx.token == Token{ "if"sv }) {
+		if (lx.token == Token{ Keyword::If }) {
 			elseStatements.emplace_back(parseIf(lx));
 		}else{
 			lx.expect('{');
@@ -255,18 +311,24 @@ UPAST parseIf(Lexer& lx){
 			lx.next();
 		}
 	}
-	return std::make_unique<IfStatement>(line, std::move(con), std::move(ifStatements), std::move(elseStatements));
+	return lx.arena.make<IfStatement>(line, con, lx.arena.list(ifStatements), lx.arena.list(elseStatements));
 }
-UPAST parseStatement(Lexer& lx) {
+inline AST* parseStatement(Lexer& lx) {
 	int line = lx.tokenLine;
-	if (lx.token == Token{ "if"sv }) {
-		UPAST ifStatement = parseIf(lx);
+	if (lx.token == Token{ Keyword::If }) {
+		AST* ifStatement = parseIf(lx);
 		lx.expectSemi();
 		return ifStatement;
 	}
-	if (lx.token == Token{"func"sv}) {
+	bool pure = lx.token == Token{ Keyword::Pure };
+	if (pure) {
+		lx.next();
+		if (lx.token != Token{ Keyword::Func })
+			lx.error("Expected func after pure");
+	}
+	if (lx.token == Token{ Keyword::Func }) {
 		lx.next();
-		std::string_view funcName = parseName(lx);
+		Symbol funcName = parseName(lx);
 		lx.expect('<');
 		std::vector<ParamDeclaration> params;
 		if (lx.token != Token{'>'}) {
@@ -274,7 +336,7 @@ UPAST parseStatement(Lexer& lx) {
 			auto type = parseType(lx);
 			if (!type)
 				lx.error("Expected a parameter type");
-			std::string_view paramName = parseName(lx);
+			Symbol paramName = parseName(lx);
 			params.push_back(ParamDeclaration{*type, paramName});
 			if (lx.token == Token{','}) {
 				lx.next();
@@ -287,7 +349,7 @@ UPAST parseStatement(Lexer& lx) {
 		if (!return_type)
 			lx.error("Expected a return type");
 		
-		std::vector<UPAST> statements;
+		std::vector<AST*> statements;
 		lx.expect('{');
 		while (lx.token == Token{'\n'})
 			lx.next();
@@ -297,13 +359,13 @@ UPAST parseStatement(Lexer& lx) {
 		lx.next();
 		lx.expectSemi();
 
-		return std::make_unique<FuncDeclaration>(line, funcName, std::move(params), *return_type, std::move(statements));
+		return lx.arena.make<FuncDeclaration>(line, funcName, lx.arena.list(params), *return_type, lx.arena.list(statements), pure);
 	}
-	if (lx.token == Token{ "for"sv }) {
+	if (lx.token == Token{ Keyword::For }) {
 		lx.next();
 		auto forVar = parseStatement(lx);
 		auto con = parseExpression(lx);
-		std::vector<UPAST> forStatements;
+		std::vector<AST*> forStatements;
 		lx.expect('{');
 		while (lx.token == Token{'\n'})
 			lx.next();
@@ -312,10 +374,10 @@ UPAST parseStatement(Lexer& lx) {
 		}
 		lx.next();
 		lx.expectSemi();
-		return std::make_unique<ForStatement>(line, std::move(forVar), std::move(con), std::move(forStatements));
+		return lx.arena.make<ForStatement>(line, forVar, con, lx.arena.list(forStatements));
 	}
-	if (lx.token == Token{"print"sv}) {
-		UPAST expression = nullptr;
+	if (lx.token == Token{ Keyword::Print }) {
+		AST* expression = nullptr;
 		lx.next();
 		lx.expect('(');
 		if (lx.token != Token{ ')' }) {
@@ -323,35 +385,63 @@ UPAST parseStatement(Lexer& lx) {
 		}
 		lx.expect(')');
 		lx.expectSemi();
-		return std::make_unique<PrintExpr>(line, std::move(expression));
+		return lx.arena.make<PrintExpr>(line, expression);
 	}
-	if (lx.token == Token{"throw"sv}) {
+	if (lx.token == Token{ Keyword::Throw }) {
 		lx.next();
 		lx.expect('(');
-		UPAST expression = parseExpression(lx);
+		AST* expression = parseExpression(lx);
 		lx.expect(')');
 		lx.expectSemi();
-		return std::make_unique<ErrorExpr>(line, std::move(expression));
+		return lx.arena.make<ErrorExpr>(line, expression);
 	}
-	if (lx.token == Token{"return"sv}) {
-		UPAST expression = nullptr;
+	if (lx.token == Token{ Keyword::Push } || lx.token == Token{ Keyword::Reserve }) {
+		auto op = lx.token == Token{ Keyword::Push } ? ArrayOperation::Push : ArrayOperation::Reserve;
+		lx.next();
+		lx.expect('(');
+		auto [variable, indices] = parseArrayPlace(lx);
+		lx.expect(',');
+		AST* operand = parseExpression(lx);
+		lx.expect(')');
+		lx.expectSemi();
+		return lx.arena.make<ArrayUpdate>(line, op, variable, indices, operand);
+	}
+	if (lx.token == Token{ Keyword::Return }) {
+		AST* expression = nullptr;
 		lx.next();
 		if(lx.token != Token{';'} && lx.token != Token{'\n'})
 			expression = parseExpression(lx);
 		lx.expectSemi();
-		return std::make_unique<ReturnStatement>(line, std::move(expression));
+		return lx.arena.make<ReturnStatement>(line, expression);
 	}
 	auto type = parseType(lx);
 
 	if (type.has_value()) {
-		std::string_view name = parseName(lx);
+		Symbol name = parseName(lx);
 		lx.expect('=');
-		UPAST expr = parseExpression(lx);
+		AST* expr = parseExpression(lx);
 		lx.expectSemi();
-		return std::make_unique<VariableDeclaration>(line, name, type.value(), std::move(expr));
+		return lx.arena.make<VariableDeclaration>(line, name, type.value(), expr);
 	}
 	
-	UPAST expr = parseExpression(lx);
+	AST* expr = parseExpression(lx);
+	if (lx.token == Token{ '=' }) {
+		// Element assignment: the expression must be a variable indexed at least once.
+		std::vector<AST*> indices;
+		auto index = dynamic_cast<BinaryExpr*>(expr);
+		while (index != nullptr && index->op == BinaryOperator::Index) {
+			indices.insert(indices.begin(), index->right);
+			expr = index->left;
+			index = dynamic_cast<BinaryExpr*>(expr);
+		}
+		auto variable = dynamic_cast<VariableExpr*>(expr);
+		if (variable == nullptr || indices.empty())
+			lx.error("Expected an array element");
+		lx.next();
+		AST* value = parseExpression(lx);
+		lx.expectSemi();
+		return lx.arena.make<ArrayUpdate>(line, ArrayOperation::Assign, variable, lx.arena.list(indices), value);
+	}
 	lx.expectSemi();
 	return expr;
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "builtins.h"
+#include <condition_variable>
+#include <exception>
+#include <thread>
+
+
+// Runs the indices 0..<count of a task on every core: the calling thread and size() - 1 workers,
+// started on first use and kept for the next task. Each participant starts with an equal slice of
+// the indices and takes grains from its front; one that runs dry steals the back half of the
+// largest slice left, so uneven work still keeps everyone busy.
+// threadsRunning is set on every participant while it works. Tasks started from inside a task,
+// or while another thread (another interpreter) has the pool, run serially on the caller.
+class WorkerPool {
+	struct alignas(64) Slice {
+		std::atomic<uint64_t> range{0}; // begin in the high 32 bits, end in the low ones
+	};
+
+	static uint64_t pack(uint64_t begin, uint64_t end) { return begin << 32 | end; }
+	static uint32_t begin(uint64_t range) { return uint32_t(range >> 32); }
+	static uint32_t end(uint64_t range) { return uint32_t(range); }
+
+	using Task = std::function<void(size_t index, size_t self)>;
+
+	size_t participants = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+	std::unique_ptr<Slice[]> slices;
+	Task const* task = nullptr;
+	uint32_t grain = 1;
+
+	std::mutex claim; // held by the thread whose task the pool runs
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	uint64_t generation = 0;
+	size_t busy = 0;
+	bool stopping = false;
+	std::exception_ptr failure;
+	std::atomic<bool> failed = false;
+
+	bool take(Slice& slice, uint32_t& first, uint32_t& last) {
+		uint64_t range = slice.range.load(std::memory_order_relaxed);
+		while (begin(range) < end(range)) {
+			first = begin(range);
+			last = std::min(end(range), first + grain);
+			if (slice.range.compare_exchange_weak(range, pack(last, end(range))))
+				return true;
+		}
+		return false;
+	}
+
+	// Moves the back half of the largest other slice into our own, which is empty.
+	bool steal(size_t self) {
+		while (!failed.load(std::memory_order_relaxed)) {
+			Slice* victim = nullptr;
+			uint64_t range = 0;
+			uint32_t largest = 0;
+			for (size_t i = 0; i < participants; i++) {
+				uint64_t r = slices[i].range.load(std::memory_order_relaxed);
+				if (i != self && end(r) > begin(r) && end(r) - begin(r) > largest) {
+					victim = &slices[i];
+					range = r;
+					largest = end(r) - begin(r);
+				}
+			}
+			if (victim == nullptr)
+				return false;
+			uint32_t middle = begin(range) + largest / 2;
+			if (victim->range.compare_exchange_strong(range, pack(begin(range), middle))) {
+				slices[self].range.store(pack(middle, end(range)));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(size_t self) {
+		try {
+			uint32_t first, last;
+			do {
+				while (!failed.load(std::memory_order_relaxed) && take(slices[self], first, last))
+					for (uint32_t i = first; i < last; i++)
+						(*task)(i, self);
+			} while (steal(self));
+		}
+		catch (...) {
+			std::lock_guard lock(mutex);
+			if (!failure)
+				failure = std::current_exception();
+			failed = true;
+		}
+	}
+
+	void serve(size_t self) {
+		uint64_t seen = 0;
+		std::unique_lock lock(mutex);
+		while (true) {
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			lock.unlock();
+			threadsRunning = true;
+			work(self);
+			threadsRunning = false;
+			lock.lock();
+			if (--busy == 0)
+				finished.notify_one();
+		}
+	}
+
+public:
+	~WorkerPool() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	size_t size() const { return participants; }
+
+	// Before the first run only.
+	void resize(size_t count) {
+		participants = std::max<size_t>(1, count);
+	}
+
+	// Rethrows the first exception a task threw, once every participant has stopped.
+	void run(size_t count, Task const& run) {
+		std::unique_lock claimed(claim, std::defer_lock);
+		if (threadsRunning || participants == 1 || count < 2 || !claimed.try_lock()) {
+			for (size_t i = 0; i < count; i++)
+				run(i, 0);
+			return;
+		}
+		if (threads.empty()) {
+			slices = std::make_unique<Slice[]>(participants);
+			for (size_t i = 1; i < participants; i++)
+				threads.emplace_back([this, i] { serve(i); });
+		}
+		grain = uint32_t(std::clamp<size_t>(count / (participants * 16), 1, 1024));
+		for (size_t i = 0; i < participants; i++)
+			slices[i].range.store(pack(count * i / participants, count * (i + 1) / participants));
+		{
+			std::lock_guard lock(mutex);
+			task = &run;
+			failed = false;
+			failure = nullptr;
+			busy = participants - 1;
+			generation++;
+		}
+		wake.notify_all();
+		threadsRunning = true;
+		work(0);
+		threadsRunning = false;
+		std::unique_lock lock(mutex);
+		finished.wait(lock, [&] { return busy == 0; });
+		if (failure)
+			std::rethrow_exception(failure);
+	}
+};
+
+inline WorkerPool pool;
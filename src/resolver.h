@@ -0,0 +1,214 @@
+#include "parseExpressions.h"
+
+
+// Assigns every variable a slot: globals index Ctx::globals, locals and parameters
+// index the current call frame on Ctx::stack. Both tables are indexed by Symbol::id, -1 is undeclared.
+// Along the way it records the declared type of every slot and function for the type checker;
+// a slot or function declared with two different types has no static type (nullopt / null).
+// Once everything is resolved, link() binds each call to its function's declaration.
+// A function that reads a global and also declares a local of that name is rejected: under the
+// old dynamic scope such a read saw the local's value from an earlier loop iteration, so silently
+// reading the global instead would change what the program computes.
+struct Resolver {
+	struct FunctionInfo {
+		FuncDeclaration* first = nullptr;
+		int declarations = 0;
+		bool redeclared = false;
+	};
+
+	std::vector<int> globals;
+	std::vector<int> locals;
+	std::vector<Symbol> declaredLocals;
+	std::vector<std::optional<Type>> globalTypes;
+	std::vector<std::optional<Type>> localTypes;
+	std::vector<FunctionInfo> functions;
+	bool inFunction = false;
+	std::vector<FuncDeclaration*> pendingFuncs;
+	std::vector<FuncCallExpression*> calls;
+	std::vector<VariableExpr*> globalReads; // in the function being resolved
+
+	Resolver(size_t symbolCount) :
+		globals(symbolCount, -1), locals(symbolCount, -1), functions(symbolCount) {}
+
+	int declare(Symbol name, Type type) {
+		auto& slots = inFunction ? locals : globals;
+		auto& types = inFunction ? localTypes : globalTypes;
+		int& slot = slots[name.id];
+		if (slot < 0) {
+			slot = int(types.size());
+			types.push_back(type);
+			if (inFunction)
+				declaredLocals.push_back(name);
+		}
+		else if (types[slot] != type)
+			types[slot] = std::nullopt;
+		return slot;
+	}
+
+	void declareFunction(FuncDeclaration* func) {
+		auto& info = functions[func->name.id];
+		auto known = info.first;
+		if (known == nullptr)
+			info.first = func;
+		else if (known->return_type != func->return_type || !std::ranges::equal(known->params, func->params,
+				[](auto& a, auto& b) { return a.type == b.type; }))
+			info.redeclared = true;
+		info.declarations++;
+	}
+
+	FuncDeclaration* signature(Symbol name) const {
+		auto& info = functions[name.id];
+		return info.redeclared ? nullptr : info.first;
+	}
+
+	// A function declared exactly once is bound to its call sites here and callable from anywhere.
+	// Names declared several times are looked up in Ctx::funcs at each call, which holds whichever
+	// declaration ran last. Script functions hide builtins of the same name.
+	void link() {
+		for (auto call : calls) {
+			auto& info = functions[call->name.id];
+			if (info.declarations > 0)
+				call->builtins = {};
+			else if (call->builtins.empty())
+				call->error("no such function");
+			if (info.declarations == 1)
+				call->func = info.first;
+		}
+	}
+
+	// Function bodies are resolved after the top level so they can read globals declared below them.
+	void resolveProgram(std::span<AST*> statements) {
+		for (auto& statement : statements)
+			statement->resolve(*this);
+		while (!pendingFuncs.empty()) {
+			auto func = pendingFuncs.back();
+			pendingFuncs.pop_back();
+			inFunction = true;
+			for (auto& param : func->params) {
+				if (locals[param.name.id] >= 0)
+					func->error("duplicate parameter name");
+				declare(param.name, param.type);
+			}
+			for (auto& statement : func->body)
+				statement->resolve(*this);
+			for (auto read : globalReads)
+				if (locals[read->name.id] >= 0)
+					read->error("variable read before its declaration");
+			globalReads.clear();
+			func->frameSize = int(declaredLocals.size());
+			func->slotTypes = std::move(localTypes);
+			localTypes.clear();
+			for (auto name : declaredLocals)
+				locals[name.id] = -1;
+			declaredLocals.clear();
+			inFunction = false;
+		}
+		link();
+	}
+};
+
+inline void ArrayExpr::resolve(Resolver& r) {
+	for (auto& element : elements)
+		element->resolve(r);
+}
+
+inline void StringExpr::resolve(Resolver&) {}
+
+inline void VariableExpr::resolve(Resolver& r) {
+	if (r.inFunction && r.locals[name.id] >= 0) {
+		slot = r.locals[name.id];
+		return;
+	}
+	if (r.globals[name.id] >= 0) {
+		slot = r.globals[name.id];
+		global = true;
+		if (r.inFunction)
+			r.globalReads.push_back(this);
+		return;
+	}
+	error("no such variable");
+}
+
+inline void IntExpr::resolve(Resolver&) {}
+
+inline void NumberExpr::resolve(Resolver&) {}
+
+inline void BoolExpr::resolve(Resolver&) {}
+
+inline void NotExpr::resolve(Resolver& r) {
+	operand->resolve(r);
+}
+
+inline void InputExpr::resolve(Resolver&) {}
+
+inline void exitExpr::resolve(Resolver&) {}
+
+inline void BinaryExpr::resolve(Resolver& r) {
+	left->resolve(r);
+	right->resolve(r);
+}
+
+inline void PrintExpr::resolve(Resolver& r) {
+	if (printee != nullptr)
+		printee->resolve(r);
+}
+
+inline void ErrorExpr::resolve(Resolver& r) {
+	error->resolve(r);
+}
+
+inline void ArraySizeExpr::resolve(Resolver& r) {
+	arr->resolve(r);
+}
+
+inline void FuncCallExpression::resolve(Resolver& r) {
+	for (auto& arg : args)
+		arg->resolve(r);
+	r.calls.push_back(this);
+}
+
+inline void ParallelMapExpr::resolve(Resolver& r) {
+	array->resolve(r);
+	call->resolve(r);
+}
+
+inline void ArrayUpdate::resolve(Resolver& r) {
+	variable->resolve(r);
+	for (auto& index : indices)
+		index->resolve(r);
+	if (operand != nullptr)
+		operand->resolve(r);
+}
+
+inline void ForStatement::resolve(Resolver& r) {
+	variable->resolve(r);
+	condition->resolve(r);
+	for (auto& statement : forStatements)
+		statement->resolve(r);
+}
+
+inline void IfStatement::resolve(Resolver& r) {
+	condition->resolve(r);
+	for (auto& statement : ifStatements)
+		statement->resolve(r);
+	for (auto& statement : elseStatements)
+		statement->resolve(r);
+}
+
+inline void ReturnStatement::resolve(Resolver& r) {
+	if (!r.inFunction)
+		error("return outside of a function");
+	if (returnee != nullptr)
+		returnee->resolve(r);
+}
+
+inline void VariableDeclaration::resolve(Resolver& r) {
+	expr->resolve(r);
+	global = !r.inFunction;
+	slot = r.declare(name, type);
+}
+
+inline void FuncDeclaration::resolve(Resolver& r) {
+	r.pendingFuncs.push_back(this);
+	r.declareFunction(this);
+}
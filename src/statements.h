@@ -2,18 +2,18 @@
 
 
 struct ForStatement : AST {
-	UPAST variable, condition;
-	std::vector<UPAST> forStatements;
+	AST *variable, *condition;
+	std::span<AST*> forStatements;
 	
-	ForStatement(int line, UPAST variable, UPAST condition, std::vector<UPAST>&& forStatements) :
-		AST(line), variable(std::move(variable)), condition(std::move(condition)), forStatements(std::move(forStatements)) {}
+	ForStatement(int line, AST* variable, AST* condition, std::span<AST*> forStatements) :
+		AST(line), variable(variable), condition(condition), forStatements(forStatements) {}
 	
 	Value evaluate(Ctx& ctx) {
 		Value valVar = variable->evaluate(ctx);
 		while (true) {
 			Value valCon = condition->evaluate(ctx);
-			if (auto con = std::get_if<bool>(&valCon)) {
-				if (!*con) {
+			if (valCon.isBool()) {
+				if (!valCon.asBool()) {
 					break;
 				}
 			}
@@ -22,21 +22,29 @@ struct ForStatement : AST {
 			}
 			for (auto &el : forStatements) {
 				el->evaluate(ctx);
+				if (ctx.completion != Completion::Normal)
+					return std::monostate();
 			}
 		}
 		return std::monostate();
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
 struct IfStatement : AST {
-	UPAST condition;
-	std::vector<UPAST> ifStatements, elseStatements;
-	IfStatement(int line, UPAST condition, std::vector<UPAST>&& ifStatements, std::vector<UPAST>&& elseStatements) :
-		AST(line), condition(std::move(condition)), ifStatements(std::move(ifStatements)),
-		elseStatements(std::move(elseStatements)){}
+	AST* condition;
+	std::span<AST*> ifStatements, elseStatements;
+	IfStatement(int line, AST* condition, std::span<AST*> ifStatements, std::span<AST*> elseStatements) :
+		AST(line), condition(condition), ifStatements(ifStatements),
+		elseStatements(elseStatements){}
 	Value evaluate(Ctx& ctx) {
 		Value val = condition->evaluate(ctx);
-		if (auto boolean = std::get_if<bool>(&val)) {
-			evalStatements(ctx, *boolean ? ifStatements : elseStatements);
+		if (val.isBool()) {
+			evalStatements(ctx, val.asBool() ? ifStatements : elseStatements);
 			return std::monostate{};
 		}
 		else {
@@ -44,16 +52,35 @@ struct IfStatement : AST {
 		}
 
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
 
 
 
 struct ReturnStatement : AST {
-	UPAST returnee;
+	AST* returnee;
+	FuncCallExpression* tailCall = nullptr; // the returnee, when the type checker found it can reuse the frame
 	
-	ReturnStatement(int line, UPAST returnee) : AST(line), returnee(std::move(returnee)) {}
+	ReturnStatement(int line, AST* returnee) : AST(line), returnee(returnee) {}
 	
 	Value evaluate(Ctx& ctx) {
-		throw returnee == nullptr ? std::monostate{} : returnee->evaluate(ctx);
+		if (tailCall != nullptr) {
+			tailCall->pushTailArgs(ctx);
+			return std::monostate{};
+		}
+		ctx.returnValue = returnee == nullptr ? Value{} : returnee->evaluate(ctx);
+		ctx.completion = Completion::Return;
+		return std::monostate{};
 	}
+	void resolve(Resolver& r);
+	void compile(Compiler& c);
+	void compileStatement(Compiler& c, bool checkVoid);
+	AST* fold(Folder& f);
+	AST* check(TypeChecker& c);
+	bool alwaysVoid() const { return true; }
 };
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "resolver.h"
+
+
+// The static counterpart of binaryOperation: the result type for operands of the given types,
+// or nullopt when it depends on run-time values (elements of untyped arrays). Combinations
+// binaryOperation rejects are reported with the same message it would give.
+static std::optional<Type> binaryType(AST& node, BinaryOperator op, Type left, Type right) {
+	using enum BinaryOperator;
+	bool comparison = op == Equal || op == NotEquals || op == Less || op == LessEquals || op == Greater || op == GreaterEquals;
+	auto number = [](Type type) { return type == Type::Int || type == Type::Double; };
+	if (op == Index) {
+		if (left == Type::String && number(right))
+			return Type::String;
+		if (!isArrayType(left))
+			node.error("NOT AN ARRAY");
+		if (!number(right))
+			node.error("index must be a number");
+		if (left == Type::Array)
+			return std::nullopt;
+		return elementOf(left);
+	}
+	if (left == Type::Int && right == Type::Int) {
+		if (op == AndAnd || op == OrOr)
+			node.error("Unknown binary operator");
+		return comparison ? Type::Bool : op == Divide ? Type::Double : Type::Int;
+	}
+	if (number(left) && number(right)) {
+		if (op == AndAnd || op == OrOr)
+			node.error("Unknown binary operator");
+		return comparison ? Type::Bool : Type::Double;
+	}
+	if (left == Type::String && right == Type::String) {
+		if (comparison)
+			return Type::Bool;
+		if (op == Add)
+			return Type::String;
+		if (op == Subtract)
+			return Type::Double;
+		node.error("no such binary operator");
+	}
+	if (left == Type::String && number(right)) {
+		if (op == Add || op == Multiply)
+			return Type::String;
+		node.error("no such binary operator for this kinds of values");
+	}
+	if (left == Type::Bool && right == Type::Bool) {
+		if (op == AndAnd || op == OrOr || op == Equal || op == NotEquals)
+			return Type::Bool;
+	}
+	if (isArrayType(left) && isArrayType(right)) {
+		if (op == Add)
+			return left == right ? left : Type::Array;
+	}
+	if (isArrayType(left) && number(right)) {
+		if (op == Multiply || op == Subtract)
+			return left;
+		node.error("no such binary operator for these kinds of values");
+	}
+	node.error("Both values need to be numbers");
+}
+
+// Infers expression types from the declared types of variables, parameters and functions,
+// reports type errors before anything runs, and swaps BinaryExprs over known double, bool and
+// string operands for TypedBinaryExprs. Whatever has no static type (array elements, names
+// declared with different types) is still checked at run time.
+// It also verifies that pure functions depend on nothing but their arguments before their
+// results get cached.
+struct TypeChecker {
+	Arena& arena;
+	Resolver& resolver;
+	FuncDeclaration* function = nullptr;
+	std::optional<Type> result;
+	size_t specialized = 0;
+	std::vector<FuncDeclaration*> pureFunctions;
+
+	TypeChecker(Arena& arena, Resolver& resolver) : arena(arena), resolver(resolver) {}
+
+	std::optional<Type> check(AST*& node) {
+		node = node->check(*this);
+		return result;
+	}
+	AST* typed(std::optional<Type> type, AST* node) {
+		result = type;
+		return node;
+	}
+
+	void checkStatements(std::span<AST*> statements, bool checkVoid) {
+		for (auto& statement : statements) {
+			auto type = check(statement);
+			if (checkVoid && type && *type != Type::Void)
+				statement->error("Statement is not void");
+		}
+	}
+
+	// Ints are promoted where doubles are declared. Arrays of one type go where arrays of another
+	// are declared if their elements would; an untyped array is checked element by element at run time.
+	static bool assignable(Type from, Type to) {
+		if (from == to || (from == Type::Int && to == Type::Double))
+			return true;
+		if (!isArrayType(from) || !isArrayType(to))
+			return false;
+		return from == Type::Array || to == Type::Array || assignable(elementOf(from), elementOf(to));
+	}
+
+	// What a value of the type can be bound to: a variable, parameter, return value or array element
+	// declared with the other. A double also goes where an int is declared; whether it has a whole
+	// value is checked when it is converted at run time (see conforms()). Overloads of builtins are
+	// still picked by assignable(), so a double argument never selects an int overload.
+	static bool bindable(Type from, Type to) {
+		return assignable(from, to) || (from == Type::Double && to == Type::Int);
+	}
+
+	// An int literal where a double is expected becomes a double literal, so the code around it
+	// needs no promotion at run time.
+	void promote(AST*& node, std::optional<Type>& type, Type expected) {
+		auto literal = dynamic_cast<IntExpr*>(node);
+		if (literal == nullptr || expected != Type::Double)
+			return;
+		node = arena.make<NumberExpr>(literal->line, double(literal->val));
+		type = Type::Double;
+	}
+
+	// Pure builtins touch nothing but their arguments, so pure functions may call them. The first
+	// overload the argument types fit without a run-time check (an untyped array needs one) is
+	// bound statically; otherwise every call picks one by its argument values.
+	std::optional<Type> checkBuiltin(FuncCallExpression& call, std::vector<std::optional<Type>>& argTypes) {
+		auto fits = [&](Builtin const& builtin, bool statically) {
+			if (builtin.params.size() != argTypes.size())
+				return false;
+			for (size_t i = 0; i < argTypes.size(); i++) {
+				if (!argTypes[i])
+					return !statically;
+				// An untyped array, or a double where an int is expected, is converted at run time.
+				bool dynamic = (*argTypes[i] == Type::Array && builtin.params[i] != Type::Array) ||
+					(*argTypes[i] == Type::Double && builtin.params[i] == Type::Int);
+				if (!bindable(*argTypes[i], builtin.params[i]) || (statically && dynamic))
+					return false;
+			}
+			return true;
+		};
+		auto overloads = call.builtins;
+		if (!std::ranges::all_of(overloads, &Builtin::pure))
+			forbidInPure(call, "pure functions can only call pure functions");
+		if (std::ranges::none_of(overloads, [&](auto& b) { return b.params.size() == argTypes.size(); }))
+			call.error("Invalid number of arguments ?!");
+		if (auto bound = std::ranges::find_if(overloads, [&](auto& b) { return fits(b, true); }); bound != overloads.end()) {
+			call.builtins = overloads.subspan(size_t(bound - overloads.begin()), 1);
+			call.argsChecked = true;
+			for (size_t i = 0; i < argTypes.size(); i++) {
+				promote(call.args[i], argTypes[i], bound->params[i]);
+				call.argsChecked = call.argsChecked && *argTypes[i] == bound->params[i];
+			}
+			return bound->returnType;
+		}
+		if (std::ranges::none_of(overloads, [&](auto& b) { return fits(b, false); }))
+			call.error("wrong type of argument");
+		auto returned = overloads[0].returnType;
+		bool same = std::ranges::all_of(overloads, [&](auto& b) { return b.returnType == returned; });
+		return same ? std::optional(returned) : std::nullopt;
+	}
+
+	void forbidInPure(AST& node, char const* message) const {
+		if (function != nullptr && function->pure)
+			node.error(message);
+	}
+
+	std::optional<Type> variableType(bool global, int slot) const {
+		return global ? resolver.globalTypes[slot] : function->slotTypes[slot];
+	}
+};
+
+// A literal whose elements all have the same type is built as an array of that type.
+inline AST* ArrayExpr::check(TypeChecker& c) {
+	std::optional<Type> common;
+	bool same = !elements.empty();
+	for (auto& element : elements) {
+		auto type = c.check(element);
+		same = same && type && !isArrayType(*type) && *type != Type::Void && (!common || *common == *type);
+		common = type;
+	}
+	elementType = same ? *common : Type::Void;
+	return c.typed(arrayOf(elementType), this);
+}
+
+inline AST* StringExpr::check(TypeChecker& c) {
+	return c.typed(Type::String, this);
+}
+
+inline AST* VariableExpr::check(TypeChecker& c) {
+	if (global)
+		c.forbidInPure(*this, "pure functions cannot read globals");
+	return c.typed(c.variableType(global, slot), this);
+}
+
+inline AST* IntExpr::check(TypeChecker& c) {
+	return c.typed(Type::Int, this);
+}
+
+inline AST* NumberExpr::check(TypeChecker& c) {
+	return c.typed(Type::Double, this);
+}
+
+inline AST* BoolExpr::check(TypeChecker& c) {
+	return c.typed(Type::Bool, this);
+}
+
+inline AST* NotExpr::check(TypeChecker& c) {
+	if (auto type = c.check(operand); type && *type != Type::Bool)
+		error("TYPE IS NOT BOOLEAN");
+	return c.typed(Type::Bool, this);
+}
+
+inline AST* InputExpr::check(TypeChecker& c) {
+	c.forbidInPure(*this, "not allowed in a pure function");
+	return c.typed(mode == InputMode::Lines ? Type::StringArray : Type::String, this);
+}
+
+inline AST* exitExpr::check(TypeChecker& c) {
+	c.forbidInPure(*this, "not allowed in a pure function");
+	return c.typed(std::nullopt, this);
+}
+
+inline AST* BinaryExpr::check(TypeChecker& c) {
+	auto leftType = c.check(left);
+	auto rightType = c.check(right);
+	if (!leftType || !rightType)
+		return c.typed(std::nullopt, this);
+	c.promote(left, leftType, *rightType);
+	c.promote(right, rightType, *leftType);
+	auto type = binaryType(*this, op, *leftType, *rightType);
+	AST* node = typedDispatch<AST*>(op, *leftType, *rightType, [&]<BinaryOperator Op, class T>() {
+		return c.arena.make<TypedBinaryExpr<Op, T>>(line, left, right, op);
+	});
+	if (node == nullptr)
+		return c.typed(type, this);
+	c.specialized++;
+	return c.typed(type, node);
+}
+
+inline AST* PrintExpr::check(TypeChecker& c) {
+	c.forbidInPure(*this, "not allowed in a pure function");
+	if (printee != nullptr)
+		c.check(printee);
+	return c.typed(Type::Void, this);
+}
+
+inline AST* ErrorExpr::check(TypeChecker& c) {
+	c.forbidInPure(*this, "not allowed in a pure function");
+	c.check(error);
+	return c.typed(Type::Void, this);
+}
+
+inline AST* ArraySizeExpr::check(TypeChecker& c) {
+	if (auto type = c.check(arr); type && !isArrayType(*type) && *type != Type::String)
+		error("operand of array size expression must be an array");
+	return c.typed(Type::Int, this);
+}
+
+// Linked calls always reach their function. An unlinked call before any of its declarations has
+// run finds no function and returns void, so only calls with arguments (which would fail the
+// arity check instead) get the declared return type. Int arguments to double parameters, and
+// double arguments to int parameters, are still checked at run time, which converts them.
+inline AST* FuncCallExpression::check(TypeChecker& c) {
+	std::vector<std::optional<Type>> argTypes;
+	for (auto& arg : args)
+		argTypes.push_back(c.check(arg));
+	if (!builtins.empty())
+		return c.typed(c.checkBuiltin(*this, argTypes), this);
+	if (func == nullptr || !func->pure)
+		c.forbidInPure(*this, "pure functions can only call pure functions");
+	auto signature = func != nullptr ? func : c.resolver.signature(name);
+	if (signature == nullptr)
+		return c.typed(std::nullopt, this);
+	if (signature->params.size() != args.size())
+		error("Invalid number of arguments ?!");
+	argsChecked = true;
+	for (size_t i = 0; i < args.size(); i++) {
+		c.promote(args[i], argTypes[i], signature->params[i].type);
+		if (!argTypes[i] || *argTypes[i] != signature->params[i].type)
+			argsChecked = false;
+		if (argTypes[i] && !c.bindable(*argTypes[i], signature->params[i].type))
+			args[i]->error("wrong type of argument");
+	}
+	bool returns = func != nullptr || !args.empty();
+	return c.typed(returns ? std::optional(signature->return_type) : std::nullopt, this);
+}
+
+// The workers run f without locks, which only a pure f makes safe: it reads no globals and
+// calls nothing but other pure functions.
+inline AST* ParallelMapExpr::check(TypeChecker& c) {
+	auto arrayType = c.check(array);
+	if (arrayType && !isArrayType(*arrayType))
+		error("NOT AN ARRAY");
+	if (call->func == nullptr)
+		error("pmap needs a function declared once");
+	auto& func = *call->func;
+	if (!func.pure)
+		error("pmap needs a pure function");
+	if (func.params.size() != 1)
+		error("Invalid number of arguments ?!");
+	if (func.return_type == Type::Void)
+		error("pmap needs a function that returns a value");
+	auto element = arrayType ? elementOf(*arrayType) : Type::Void;
+	if (element != Type::Void && !c.bindable(element, func.params[0].type))
+		error("wrong type of argument");
+	elementsChecked = element != Type::Void && element == func.params[0].type;
+	resultElement = isArrayType(func.return_type) ? Type::Void : func.return_type;
+	return c.typed(arrayOf(resultElement), this);
+}
+
+// Only updates of the variable's own array know its element type; nested arrays are untyped.
+inline AST* ArrayUpdate::check(TypeChecker& c) {
+	variable->check(c);
+	auto arrayType = c.result;
+	if (arrayType && !isArrayType(*arrayType))
+		error("NOT AN ARRAY");
+	for (auto& index : indices)
+		if (auto type = c.check(index); type && !c.assignable(*type, Type::Double))
+			index->error("index must be a number");
+	auto operandType = operand != nullptr ? c.check(operand) : std::nullopt;
+	if (op == ArrayOperation::Reserve && operandType && !c.assignable(*operandType, Type::Double))
+		error("capacity must be a number");
+	size_t depth = op == ArrayOperation::Assign ? indices.size() - 1 : indices.size();
+	auto element = arrayType && depth == 0 ? elementOf(*arrayType) : Type::Void;
+	if (element != Type::Void && (op == ArrayOperation::Assign || op == ArrayOperation::Push)) {
+		c.promote(operand, operandType, element);
+		if (operandType && !c.bindable(*operandType, element))
+			operand->error("wrong type of array element");
+	}
+	if (op != ArrayOperation::Pop)
+		return c.typed(Type::Void, this);
+	return c.typed(element != Type::Void ? std::optional(element) : std::nullopt, this);
+}
+
+inline AST* ForStatement::check(TypeChecker& c) {
+	c.check(variable);
+	if (auto type = c.check(condition); type && *type != Type::Bool)
+		error("the condition must be a boolean");
+	c.checkStatements(forStatements, false);
+	return c.typed(Type::Void, this);
+}
+
+inline AST* IfStatement::check(TypeChecker& c) {
+	if (auto type = c.check(condition); type && *type != Type::Bool)
+		error("THE GIVEN CONDITION ISN'T A BOOLEAN");
+	c.checkStatements(ifStatements, true);
+	c.checkStatements(elseStatements, true);
+	return c.typed(Type::Void, this);
+}
+
+// Returning a linked call of the same return type is a tail call: its result needs no check of its own.
+inline AST* ReturnStatement::check(TypeChecker& c) {
+	auto type = returnee == nullptr ? std::optional(Type::Void) : c.check(returnee);
+	if (returnee != nullptr)
+		c.promote(returnee, type, c.function->return_type);
+	if (type && !c.bindable(*type, c.function->return_type))
+		error("Type missmatch. Return type must match function type");
+	auto call = dynamic_cast<FuncCallExpression*>(returnee);
+	if (call != nullptr && call->func != nullptr && call->func->return_type == c.function->return_type)
+		tailCall = call;
+	return c.typed(Type::Void, this);
+}
+
+inline AST* VariableDeclaration::check(TypeChecker& c) {
+	auto exprType = c.check(expr);
+	c.promote(expr, exprType, type);
+	if (exprType && !c.bindable(*exprType, type))
+		error("wrong type of variable initializer");
+	checked = exprType == type && !isArrayType(type);
+	auto add = dynamic_cast<BinaryExpr*>(expr);
+	auto appended = add != nullptr && add->op == BinaryOperator::Add ? dynamic_cast<VariableExpr*>(add->left) : nullptr;
+	if (appended != nullptr && appended->global == global && appended->slot == slot && c.variableType(global, slot) == Type::String) {
+		c.specialized++;
+		return c.typed(Type::Void, c.arena.make<AppendDeclaration>(*this));
+	}
+	return c.typed(Type::Void, this);
+}
+
+inline AST* FuncDeclaration::check(TypeChecker& c) {
+	c.forbidInPure(*this, "not allowed in a pure function");
+	if (pure && std::ranges::any_of(params, [](auto& param) { return isArrayType(param.type); }))
+		error("pure functions cannot take arrays");
+	auto enclosing = c.function;
+	c.function = this;
+	c.checkStatements(body, true);
+	c.function = enclosing;
+	if (pure) {
+		memo = std::make_unique<MemoTable>(params.size());
+		c.pureFunctions.push_back(this);
+	}
+	return c.typed(Type::Void, this);
+}
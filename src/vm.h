@@ -0,0 +1,753 @@
+#include "bytecode.h"
+
+
+struct Frame {
+	Instruction const* returnTo;
+	Instruction const* call; // the call whose line errors returning from it are reported at
+	size_t callerFrame;      // an offset, since the stack moves when it grows
+	Type returnType;
+	MemoTable* memo = nullptr; // the arguments below the frame are this call's memo key
+};
+
+// Fast path for the common double x double case, computed in place of the left operand.
+// An int and a double are promoted to double x double. A zero divisor of % is left to binaryOperation to report.
+static bool doubleOperation(BinaryOperator op, Value& leftVal, Value const& rightVal) {
+	double left, right;
+	if (leftVal.isDouble() && rightVal.isDouble()) {
+		left = leftVal.asDouble();
+		right = rightVal.asDouble();
+	}
+	else if (leftVal.isNumber() && rightVal.isNumber() && leftVal.isInt() != rightVal.isInt()) {
+		left = leftVal.asNumber();
+		right = rightVal.asNumber();
+	}
+	else
+		return false;
+	switch (op) {
+	case BinaryOperator::Add:
+		leftVal = left + right;
+		return true;
+	case BinaryOperator::Subtract:
+		leftVal = left - right;
+		return true;
+	case BinaryOperator::Multiply:
+		leftVal = left * right;
+		return true;
+	case BinaryOperator::Divide:
+		leftVal = left / right;
+		return true;
+	case BinaryOperator::DivideRemainder:
+		if (right == 0)
+			return false;
+		leftVal = remainderOf(left, right);
+		return true;
+	case BinaryOperator::Equal:
+		leftVal = left == right;
+		return true;
+	case BinaryOperator::NotEquals:
+		leftVal = left != right;
+		return true;
+	case BinaryOperator::Less:
+		leftVal = left < right;
+		return true;
+	case BinaryOperator::LessEquals:
+		leftVal = left <= right;
+		return true;
+	case BinaryOperator::Greater:
+		leftVal = left > right;
+		return true;
+	case BinaryOperator::GreaterEquals:
+		leftVal = left >= right;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The same for int x int. Overflow and division by zero are left to binaryOperation to report.
+static bool intOperation(BinaryOperator op, Value& leftVal, Value const& rightVal) {
+	if (!leftVal.isInt() || !rightVal.isInt())
+		return false;
+	int64_t left = leftVal.asInt(), right = rightVal.asInt(), result;
+	switch (op) {
+	case BinaryOperator::Add:
+		if (__builtin_add_overflow(left, right, &result))
+			return false;
+		leftVal = result;
+		return true;
+	case BinaryOperator::Subtract:
+		if (__builtin_sub_overflow(left, right, &result))
+			return false;
+		leftVal = result;
+		return true;
+	case BinaryOperator::Multiply:
+		if (__builtin_mul_overflow(left, right, &result))
+			return false;
+		leftVal = result;
+		return true;
+	case BinaryOperator::Equal:
+		leftVal = left == right;
+		return true;
+	case BinaryOperator::NotEquals:
+		leftVal = left != right;
+		return true;
+	case BinaryOperator::Less:
+		leftVal = left < right;
+		return true;
+	case BinaryOperator::LessEquals:
+		leftVal = left <= right;
+		return true;
+	case BinaryOperator::Greater:
+		leftVal = left > right;
+		return true;
+	case BinaryOperator::GreaterEquals:
+		leftVal = left >= right;
+		return true;
+	default: {
+		Value quotient = integerOperation(op, left, right);
+		if (quotient.isVoid())
+			return false;
+		leftVal = std::move(quotient);
+		return true;
+	}
+	}
+}
+
+// The fast path of a typed opcode, computed in place of the left operand. The type checker
+// proved the operand types, but ints may be boxed; those, overflow and division by zero are left
+// to binaryOperation.
+template<BinaryOperator Op, class T>
+static bool typedFastPath(Value& left, Value const& right) {
+	if constexpr (std::is_same_v<T, int64_t>) {
+		if (!left.isInlineInt() || !right.isInlineInt())
+			return false;
+	}
+	Value result = typedOperation<Op>(unboxed<T>(left), unboxed<T>(right));
+	if (result.isVoid())
+		return false;
+	left = std::move(result);
+	return true;
+}
+
+template<class T>
+static bool compared(BinaryOperator op, T left, T right) {
+	switch (op) {
+	case BinaryOperator::Equal:
+		return left == right;
+	case BinaryOperator::NotEquals:
+		return left != right;
+	case BinaryOperator::Less:
+		return left < right;
+	case BinaryOperator::LessEquals:
+		return left <= right;
+	case BinaryOperator::Greater:
+		return left > right;
+	default:
+		return left >= right;
+	}
+}
+
+// Reads an index in range 0..<size, as an inline int or a whole double, into index. Anything
+// else is left to binaryOperation and its errors.
+static bool wholeIndex(Value const& value, size_t size, size_t& index) {
+	if (value.isInlineInt())
+		index = size_t(value.asInt());
+	else if (value.isDouble() && value.asDouble() >= 0 && value.asDouble() < double(size) && size_t(value.asDouble()) == value.asDouble())
+		index = size_t(value.asDouble());
+	else
+		return false;
+	return index < size;
+}
+
+struct VM {
+	Chunk& chunk;
+	Ctx& ctx;
+	// Operands and call frames share one value stack: arguments become the callee's first locals.
+	// Slots above the top are always void. run() keeps raw pointers into the stack, so it grows
+	// only at calls, which leave room for the new frame and chunk.depth operands above it.
+	std::vector<Value> stack;
+	size_t top = 0;   // the top and the current frame while run() is not running
+	size_t frame = 0;
+	std::vector<Frame> frames;
+
+	VM(Chunk& chunk, Ctx& ctx) : chunk(chunk), ctx(ctx), stack(size_t(chunk.depth) + 256) {
+		frames.reserve(16);
+	}
+
+	int lineOf(Instruction const* ip) const {
+		return chunk.lines[ip - chunk.code.data()];
+	}
+
+	// Runs an instruction's slow path out of line. Whatever it throws that isn't a ScriptError yet
+	// becomes one at the instruction's line, so run() needs no handler of its own, which would
+	// keep its registers in memory.
+	template<class F>
+	[[gnu::noinline]] auto guarded(Instruction const* ip, F const& slowPath) -> decltype(slowPath()) {
+		try {
+			return slowPath();
+		}
+		catch (...) {
+			rethrowAsScriptError(lineOf(ip));
+		}
+	}
+
+	// Makes room for need values above the top and for one more frame.
+	void grow(size_t top, size_t need) {
+		if (stack.size() - top < need)
+			stack.resize(std::max(stack.size() * 2, top + need));
+		if (frames.size() == frames.capacity())
+			frames.reserve(frames.size() * 2);
+	}
+
+	// Combines the two operands in place of the left one, leaving the right one as it was moved from.
+	[[gnu::noinline]] void generic(Instruction const* ip, Value* operands) {
+		operands[0] = guarded(ip, [&] {
+			return binaryOperation(lineOf(ip), BinaryOperator(ip->b & 0xFF), std::move(operands[0]), std::move(operands[1]));
+		});
+	}
+
+	// The same through the quick int and double paths first.
+	void binary(Instruction const* ip, Value* operands) {
+		auto op = BinaryOperator(ip->b & 0xFF);
+		if (!intOperation(op, operands[0], operands[1]) && !doubleOperation(op, operands[0], operands[1]))
+			generic(ip, operands);
+		operands[1] = Value();
+	}
+
+	template<BinaryOperator Op, class T>
+	void typed(Instruction const* ip, Value* operands) {
+		if (!typedFastPath<Op, T>(operands[0], operands[1]))
+			generic(ip, operands);
+		operands[1] = Value();
+	}
+
+	// The slow path of IndexLocal and IndexGlobal: a string, an index out of range or of another
+	// type, or a variable not declared yet.
+	[[gnu::noinline]] void indexSlot(Instruction const* ip, Value* index, Value const& variable) {
+		if (variable.isVoid())
+			runtimeError(lineOf(ip), "no such variable");
+		*index = guarded(ip, [&] { return binaryOperation(lineOf(ip), BinaryOperator::Index, variable, std::move(*index)); });
+	}
+
+	[[gnu::noinline]] void convert(Instruction const* ip, Value& value) {
+		if (!guarded(ip, [&] { return converted(value, Type(ip->b >> 1)); }))
+			runtimeError(lineOf(ip), "wrong type of variable initializer");
+	}
+
+	void store(Instruction const* ip, Value& value, Value& variable) {
+		if (!(ip->b & 1) && value.type() != Type(ip->b >> 1))
+			convert(ip, value);
+		variable = std::move(value);
+	}
+
+	// The slow path of the increments: a boxed int, or a variable not declared yet.
+	[[gnu::noinline]] void increment(Instruction const* ip, Value& variable, Value step) {
+		if (variable.isVoid())
+			runtimeError(lineOf(ip), "no such variable");
+		variable = guarded(ip, [&] { return binaryOperation(lineOf(ip), BinaryOperator::Add, std::move(variable), std::move(step)); });
+	}
+
+	// Applies an UpdateLocal or UpdateGlobal to the variable, leaving the result in place of its
+	// operands. Returns the new top.
+	[[gnu::noinline]] Value* update(Instruction const* ip, Value* sp, Value& variable) {
+		if (variable.isVoid())
+			runtimeError(lineOf(ip), "no such variable");
+		size_t count = ip->b >> 2;
+		Value* indices = sp - 1 - count;
+		Value result = guarded(ip, [&] {
+			return updateArray(lineOf(ip), ArrayOperation(ip->b & 3), variable, std::span<Value const>(indices, count), std::move(sp[-1]));
+		});
+		while (sp != indices)
+			*--sp = Value();
+		*sp++ = std::move(result);
+		return sp;
+	}
+
+	[[gnu::noinline]] void append(Instruction const* ip, Value& value, Value& variable) {
+		if (variable.isVoid())
+			runtimeError(lineOf(ip), "no such variable");
+		guarded(ip, [&] { appendInPlace(lineOf(ip), variable, std::move(value)); });
+	}
+
+	[[gnu::noinline]] void checkArgs(Instruction const* ip, Value* args, std::span<ParamDeclaration const> params) {
+		bool conforming = guarded(ip, [&] {
+			for (size_t i = 0; i < params.size(); i++)
+				if (!conforms(args[i], params[i].type))
+					return false;
+			return true;
+		});
+		if (!conforming)
+			runtimeError(lineOf(ip), "wrong type of argument");
+	}
+
+	// Runs a function on one argument to completion: its frame returns to the program's Halt.
+	Value call(Instruction const* at, FuncProto const& proto, Value arg, bool checked) {
+		auto decl = proto.decl;
+		grow(top, 1 + decl->frameSize + chunk.depth);
+		Value& param = stack[top];
+		param = std::move(arg);
+		if (!checked && !conforms(param, decl->params[0].type))
+			runtimeError(lineOf(at), "wrong type of argument");
+		frames.push_back(Frame{chunk.code.data() + chunk.halt, at, frame, decl->return_type});
+		frame = top;
+		top += decl->frameSize;
+		run(proto.entry);
+		return std::move(stack[--top]);
+	}
+
+	// The workers of a pmap each run the function on a VM of their own over the same chunk.
+	Value parallelMap(Instruction const* ip, Value const& source) {
+		if (!source.isArray())
+			runtimeError(lineOf(ip), "NOT AN ARRAY");
+		auto& elements = source.asArray();
+		auto& proto = chunk.functions[ip->a];
+		std::vector<Ctx> contexts(pool.size());
+		std::vector<VM> workers;
+		for (auto& context : contexts)
+			workers.emplace_back(chunk, context);
+		std::vector<ArrayElement> results(elements.size());
+		pool.run(elements.size(), [&](size_t i, size_t self) {
+			results[i].value = workers[self].call(ip, proto, elements[i].value, ip->b & 1);
+		});
+		return Value(std::move(results), Type(ip->b >> 1));
+	}
+
+	void run(size_t pc = 0) {
+		Instruction const* const code = chunk.code.data();
+		Instruction const* ip = code + pc;
+		Value* base = stack.data();
+		Value* end = base + stack.size();
+		Value* sp = base + top;
+		Value* fp = base + frame;
+		Value* const globals = ctx.globals.data();
+		Value const* const constants = chunk.constants.data();
+
+#if defined(__GNUC__)
+		static void* const labels[] = {
+#define X(name) &&op_##name,
+			OPCODES(X)
+#undef X
+		};
+#define DISPATCH() goto *labels[size_t(ip->op)]
+#else
+#define DISPATCH() goto dispatch
+#endif
+#define VM_CASE(name) case OpCode::name: op_##name:
+// The slots above the top are void, so a copy pushed there is constructed without releasing them.
+#define PUSH_COPY(value) new (sp++) Value(value)
+
+// Before a call: room for need values above the top and for one more frame. Growing moves the stack.
+#define RESERVE(need) \
+		if (size_t(end - sp) < size_t(need) || frames.size() == frames.capacity()) { \
+			size_t used = size_t(sp - base), framed = size_t(fp - base), room = size_t(need); \
+			guarded(ip, [this, used, room] { grow(used, room); }); \
+			base = stack.data(); \
+			end = base + stack.size(); \
+			sp = base + used; \
+			fp = base + framed; \
+		}
+
+// Pops the frame and pushes the value it returns, which goes into the callee's memo table first.
+#define RETURN_FROM_FRAME(result) { \
+			Value returned = result; \
+			while (sp != fp) \
+				*--sp = Value(); \
+			Frame& callee = frames.back(); \
+			if (callee.memo != nullptr) { \
+				Value* key = fp - callee.memo->arity; \
+				callee.memo->store(std::span<Value const>(key, callee.memo->arity), returned); \
+				while (sp != key) \
+					*--sp = Value(); \
+			} \
+			fp = base + callee.callerFrame; \
+			ip = callee.returnTo; \
+			frames.pop_back(); \
+			*sp++ = std::move(returned); \
+			DISPATCH(); \
+		}
+
+#if !defined(__GNUC__)
+	dispatch:
+#endif
+		switch (ip->op) {
+		VM_CASE(Constant) {
+			PUSH_COPY(constants[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(LoadLocal) {
+			Value& variable = fp[ip->a];
+			if (variable.isVoid())
+				runtimeError(lineOf(ip), "no such variable");
+			PUSH_COPY(variable);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(LoadGlobal) {
+			Value& variable = globals[ip->a];
+			if (variable.isVoid())
+				runtimeError(lineOf(ip), "no such variable");
+			PUSH_COPY(variable);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(StoreLocal) {
+			store(ip, *--sp, fp[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(StoreGlobal) {
+			store(ip, *--sp, globals[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IncrementLocalInt) {
+			Value& variable = fp[ip->a];
+			if (variable.isInlineInt())
+				variable = Value(variable.asInt() + int16_t(ip->b));
+			else
+				increment(ip, variable, Value(int64_t(int16_t(ip->b))));
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IncrementGlobalInt) {
+			Value& variable = globals[ip->a];
+			if (variable.isInlineInt())
+				variable = Value(variable.asInt() + int16_t(ip->b));
+			else
+				increment(ip, variable, Value(int64_t(int16_t(ip->b))));
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IncrementLocalDouble) {
+			Value& variable = fp[ip->a];
+			if (variable.isDouble())
+				variable = Value(variable.asDouble() + int16_t(ip->b));
+			else
+				increment(ip, variable, Value(double(int16_t(ip->b))));
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IncrementGlobalDouble) {
+			Value& variable = globals[ip->a];
+			if (variable.isDouble())
+				variable = Value(variable.asDouble() + int16_t(ip->b));
+			else
+				increment(ip, variable, Value(double(int16_t(ip->b))));
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(UpdateLocal) {
+			sp = update(ip, sp, fp[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(UpdateGlobal) {
+			sp = update(ip, sp, globals[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(AppendLocal) {
+			append(ip, *--sp, fp[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(AppendGlobal) {
+			append(ip, *--sp, globals[ip->a]);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Pop) {
+			*--sp = Value();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(PopVoid) {
+			if (!(--sp)->isVoid())
+				runtimeError(lineOf(ip), "Statement is not void");
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Binary) {
+			sp--;
+			binary(ip, sp - 1);
+			ip++;
+			DISPATCH();
+		}
+#define Y(X, name) \
+		VM_CASE(name##Int) { \
+			sp--; \
+			typed<BinaryOperator::name, int64_t>(ip, sp - 1); \
+			ip++; \
+			DISPATCH(); \
+		} \
+		VM_CASE(name##Double) { \
+			sp--; \
+			typed<BinaryOperator::name, double>(ip, sp - 1); \
+			ip++; \
+			DISPATCH(); \
+		}
+		TYPED_OPERATORS(Y, )
+#undef Y
+		VM_CASE(AndBool) {
+			sp--;
+			sp[-1] = Value(sp[-1].asBool() && sp->asBool());
+			*sp = Value();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(OrBool) {
+			sp--;
+			sp[-1] = Value(sp[-1].asBool() || sp->asBool());
+			*sp = Value();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Index) {
+			sp--;
+			Value& container = sp[-1];
+			size_t index;
+			if (container.isArray() && wholeIndex(*sp, container.asArray().size(), index)) {
+				Value element = container.asArray()[index].value;
+				container = std::move(element);
+			}
+			else
+				generic(ip, sp - 1);
+			*sp = Value();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IndexLocal) {
+			Value& container = fp[ip->a];
+			size_t index;
+			if (container.isArray() && wholeIndex(sp[-1], container.asArray().size(), index))
+				sp[-1] = container.asArray()[index].value;
+			else
+				indexSlot(ip, sp - 1, container);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(IndexGlobal) {
+			Value& container = globals[ip->a];
+			size_t index;
+			if (container.isArray() && wholeIndex(sp[-1], container.asArray().size(), index))
+				sp[-1] = container.asArray()[index].value;
+			else
+				indexSlot(ip, sp - 1, container);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(CompareJump) {
+			sp--;
+			binary(ip, sp - 1);
+			bool taken = (--sp)->asBool() == bool(ip->b >> 8);
+			*sp = Value();
+			ip = taken ? code + ip->a : ip + 1;
+			DISPATCH();
+		}
+		VM_CASE(CompareJumpInt) {
+			sp -= 2;
+			bool taken = compared(BinaryOperator(ip->b & 0xFF), sp[0].asInt(), sp[1].asInt()) == bool(ip->b >> 8);
+			sp[0] = Value();
+			sp[1] = Value();
+			ip = taken ? code + ip->a : ip + 1;
+			DISPATCH();
+		}
+		VM_CASE(CompareJumpDouble) {
+			sp -= 2;
+			bool taken = compared(BinaryOperator(ip->b & 0xFF), sp[0].asDouble(), sp[1].asDouble()) == bool(ip->b >> 8);
+			sp[0] = Value();
+			sp[1] = Value();
+			ip = taken ? code + ip->a : ip + 1;
+			DISPATCH();
+		}
+		VM_CASE(Not) {
+			Value& val = sp[-1];
+			if (!val.isBool())
+				runtimeError(lineOf(ip), "TYPE IS NOT BOOLEAN");
+			val = !val.asBool();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Size) {
+			Value& val = sp[-1];
+			if (val.isArray())
+				val = int64_t(val.asArray().size());
+			else if (val.isString())
+				val = int64_t(val.asString().size());
+			else
+				runtimeError(lineOf(ip), "operand of array size expression must be an array");
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(MakeArray) {
+			Value* first = sp - ip->a;
+			Value array = guarded(ip, [ip, first] {
+				std::vector<ArrayElement> elements;
+				elements.reserve(ip->a);
+				for (Value* element = first; element != first + ip->a; element++)
+					elements.push_back(ArrayElement{std::move(*element)});
+				return Value(std::move(elements), Type(ip->b));
+			});
+			sp = first;
+			*sp++ = std::move(array);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Input) {
+			*sp++ = guarded(ip, [this, ip] { return readInput(ctx, InputMode(ip->a)); });
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Exit) {
+			throw ScriptError(ScriptError::Kind::Exit, lineOf(ip), "exit");
+		}
+		VM_CASE(Print) {
+			Value* printee = --sp;
+			guarded(ip, [this, printee] { printValue(*ctx.output, *printee); });
+			*printee = Value();
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(PrintNewline) {
+			guarded(ip, [this] { printNewline(*ctx.output); });
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Throw) {
+			throwValue(lineOf(ip), *--sp);
+		}
+		VM_CASE(Jump) {
+			ip = code + ip->a;
+			DISPATCH();
+		}
+		VM_CASE(JumpIfFalse) {
+			Value& condition = *--sp;
+			if (!condition.isBool())
+				runtimeError(lineOf(ip), conditionErrors[ip->b]);
+			ip = condition.asBool() ? ip + 1 : code + ip->a;
+			condition = Value();
+			DISPATCH();
+		}
+		VM_CASE(JumpIfTrue) {
+			Value& condition = *--sp;
+			if (!condition.isBool())
+				runtimeError(lineOf(ip), conditionErrors[ip->b]);
+			ip = condition.asBool() ? code + ip->a : ip + 1;
+			condition = Value();
+			DISPATCH();
+		}
+		VM_CASE(DefineFunc) {
+			auto& proto = chunk.functions[ip->a];
+			auto decl = proto.decl;
+			ctx.funcs[decl->name.id] = Func{decl->params, decl->return_type, decl->body, decl->frameSize, proto.entry};
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Call) {
+			auto func = ctx.funcs[ip->a];
+			size_t argc = ip->b;
+			if (func.params.size() != argc)
+				runtimeError(lineOf(ip), "Invalid number of arguments ?!");
+			checkArgs(ip, sp - argc, func.params);
+			RESERVE(func.frameSize + chunk.depth);
+			frames.push_back(Frame{ip + 1, ip, size_t(fp - base), func.return_type});
+			fp = sp - argc;
+			sp = fp + func.frameSize;
+			if (func.entry < 0) {
+				if (func.return_type != Type::Void)
+					runtimeError(lineOf(ip), "Reached end of non-void function");
+				RETURN_FROM_FRAME(Value());
+			}
+			ip = code + func.entry;
+			DISPATCH();
+		}
+		VM_CASE(CallDirect) {
+			auto& proto = chunk.functions[ip->a];
+			auto decl = proto.decl;
+			size_t argc = decl->params.size();
+			if (!ip->b)
+				checkArgs(ip, sp - argc, decl->params);
+			auto memo = threadsRunning ? nullptr : decl->memo.get(); // the tables are not shared between pmap workers
+			size_t copies = 0;
+			if (memo != nullptr) {
+				if (auto hit = memo->find(std::span<Value const>(sp - argc, argc))) {
+					Value result = *hit;
+					for (size_t i = 0; i < argc; i++)
+						*--sp = Value();
+					*sp++ = std::move(result);
+					ip++;
+					DISPATCH();
+				}
+				copies = argc;
+			}
+			RESERVE(copies + decl->frameSize + chunk.depth);
+			for (size_t i = 0; i < copies; i++, sp++)
+				*sp = sp[-ptrdiff_t(argc)];
+			frames.push_back(Frame{ip + 1, ip, size_t(fp - base), decl->return_type, memo});
+			fp = sp - argc;
+			sp = fp + decl->frameSize;
+			ip = code + proto.entry;
+			DISPATCH();
+		}
+		VM_CASE(TailCall) {
+			auto& proto = chunk.functions[ip->a];
+			auto decl = proto.decl;
+			size_t argc = decl->params.size();
+			if (!ip->b)
+				checkArgs(ip, sp - argc, decl->params);
+			std::move(sp - argc, sp, fp);
+			while (sp != fp + argc)
+				*--sp = Value();
+			RESERVE(decl->frameSize + chunk.depth);
+			sp = fp + decl->frameSize;
+			frames.back().call = ip;
+			ip = code + proto.entry;
+			DISPATCH();
+		}
+		VM_CASE(CallBuiltin) {
+			Value* args = sp - (ip->b >> 2);
+			Value result = guarded(ip, [this, ip, args] {
+				auto overloads = chunk.builtins->from(ip->a);
+				if (ip->b & 2)
+					overloads = overloads.first(1);
+				return callBuiltin(lineOf(ip), overloads, ip->b & 1, std::span(args, ip->b >> 2));
+			});
+			while (sp != args)
+				*--sp = Value();
+			*sp++ = std::move(result);
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(ParallelMap) {
+			sp[-1] = guarded(ip, [this, ip, sp] { return parallelMap(ip, sp[-1]); });
+			ip++;
+			DISPATCH();
+		}
+		VM_CASE(Return) {
+			if (frames.empty())
+				runtimeError(lineOf(ip), "return outside of a function");
+			Value* value = --sp;
+			if (value->type() != frames.back().returnType && !guarded(ip, [this, value] { return converted(*value, frames.back().returnType); }))
+				runtimeError(lineOf(frames.back().call), "Type missmatch. Return type must match function type");
+			RETURN_FROM_FRAME(std::move(*value));
+		}
+		VM_CASE(ReturnVoid) {
+			if (frames.back().returnType != Type::Void)
+				runtimeError(lineOf(frames.back().call), "Reached end of non-void function");
+			RETURN_FROM_FRAME(Value());
+		}
+		VM_CASE(Halt) {
+			top = size_t(sp - base);
+			frame = size_t(fp - base);
+			return;
+		}
+		}
+
+#undef RETURN_FROM_FRAME
+#undef RESERVE
+#undef PUSH_COPY
+#undef VM_CASE
+#undef DISPATCH
+	}
+};
@@ -0,0 +1,97 @@
+#include "interpreter.h"
+
+
+// An embedding program made of two source files that both include the interpreter: this one
+// makes a registry of builtins and runs programs itself, scripts.cpp runs the rest. Prints every
+// check that fails and exits with 1 if any did.
+
+std::string runScript(std::string source, Engine engine, std::string input,
+	BuiltinRegistry const& builtins = standardBuiltins());
+
+static int failures = 0;
+
+static void expect(char const* name, Engine engine, std::string const& actual, std::string const& expected) {
+	if (actual == expected)
+		return;
+	std::cout << name << (engine == Engine::VM ? " (vm)" : " (tree)") << ": got \"" << actual
+		<< "\", expected \"" << expected << "\"\n";
+	failures++;
+}
+
+int main() {
+	// Made in this file, parsed against in the other.
+	BuiltinRegistry natives;
+	natives.add({"twice", {Type::Int}, Type::Int, [](int, std::span<Value> args) { return Value(args[0].asInt() * 2); }});
+	natives.add({"fail", {}, Type::Void, [](int, std::span<Value>) -> Value { throw std::runtime_error("native failure"); }});
+	natives.add({"liar", {Type::Int}, Type::Int, [](int, std::span<Value>) { return Value(std::string("not an int")); }});
+	pool.resize(4);
+
+	for (auto engine : {Engine::Tree, Engine::VM}) {
+		expect("builtin", engine, runScript("print(twice(21))\n", engine, "", natives), "42");
+		expect("input", engine, runScript("string name = input()\nprint(\"hi \" + name)\n", engine, "bob\n"), "hi bob");
+		expect("type error", engine, runScript("print(1)\nprint(1 + \"a\")\n", engine, ""),
+			"[error at 2: Both values need to be numbers]");
+		expect("syntax error", engine, runScript("print(2 +)\n", engine, ""), "[error at 1: expected an expression]");
+		expect("runtime error", engine, runScript("print(1)\narray<int> a = []\nprint(pop(a))\n", engine, ""),
+			"1[error at 3: pop from an empty array]");
+		expect("native arguments", engine, runScript("print(1)\nprint(twice(\"a\"))\n", engine, "", natives),
+			"[error at 2: wrong type of argument]");
+		expect("native conversion", engine, runScript("double d = 6 / 2\nprint(twice(d))\n", engine, "", natives), "6");
+		expect("native result", engine, runScript("print(1)\nprint(liar(1))\n", engine, "", natives),
+			"1[error at 2: Type missmatch. Return type must match function type]");
+		expect("native exception", engine, runScript("print(1)\nfail()\n", engine, "", natives), "1[error at 2: native failure]");
+		expect("not a number", engine, runScript("print(\"x\" - \"1\")\n", engine, ""), "[error at 1: the string is not a number]");
+		expect("reserve", engine, runScript("array<int> a = []\nreserve(a, 999999999)\n", engine, ""),
+			"[error at 2: capacity must be in range 0..1e8]");
+		expect("thrown", engine, runScript("throw(\"boom\")\n", engine, ""), "[thrown at 1: boom]");
+		expect("exit", engine, runScript("print(1)\nexit()\nprint(2)\n", engine, ""), "1[exit at 2: exit]");
+		expect("pmap", engine, runScript("pure func sq<int x> int {\n\treturn twice(x) * x\n}\nprint(pmap(sq, [1, 2, 3]))\n", engine, "", natives),
+			"[2, 8, 18]");
+		expect("pmap error", engine, runScript("pure func f<int x> int {\n\treturn x // (x - 50)\n}\narray<int> a = []\n"
+			"for int i = 0; i < 1000 {\n\tpush(a, i)\n\tint i = i + 1\n}\nprint(pmap(f, a))\n", engine, ""),
+			"[error at 2: division by zero]");
+
+		// Compiled once here, run many times with fresh globals and the input each run is given.
+		auto program = Program::fromText("string line = input()\nint n = 0\nfor int i = 0; i < line? {\n"
+			"\tint n = n + twice(1)\n\tint i = i + 1\n}\nprint(n)\n", engine, nullptr, natives);
+		for (auto [line, count] : {std::pair{"ab", "4"}, {"abcde", "10"}, {"", "0"}}) {
+			std::istringstream in(std::string(line) + "\n");
+			std::ostringstream out;
+			Interpreter interpreter(out, in);
+			interpreter.run(*program);
+			expect("run many", engine, out.str(), count);
+		}
+	}
+	// Interpreters share no state, so host threads may each compile and run programs at once.
+	std::vector<std::thread> hosts;
+	std::vector<std::string> results(8);
+	for (size_t t = 0; t < results.size(); t++)
+		hosts.emplace_back([&results, t] {
+			auto engine = t % 2 == 0 ? Engine::Tree : Engine::VM;
+			for (int round = 0; round < 20; round++)
+				results[t] = runScript("func f<int n> int {\n\tif n < 2 {\n\t\treturn n\n\t}\n\treturn f(n - 1) + f(n - 2)\n}\n"
+					"string s = \"\"\nfor int i = 0; i < 5 {\n\tstring s = s + f(i + " + std::to_string(t) + ")\n\tint i = i + 1\n}\nprint(s)\n", engine, "");
+		});
+	for (auto& host : hosts)
+		host.join();
+	for (auto [t, expected] : {std::pair{0, "01123"}, {1, "11235"}, {6, "813213455"}, {7, "1321345589"}})
+		expect("threads", t % 2 == 0 ? Engine::Tree : Engine::VM, results[size_t(t)], expected);
+
+	// Only the programs compiled with natives see them; the standard builtins stay as they were.
+	for (auto engine : {Engine::Tree, Engine::VM}) {
+		expect("other registry", engine, runScript("print(twice(21))\n", engine, ""), "[error at 1: no such function]");
+		expect("standard builtins", engine, runScript("print(sum(scale([1, 2], 3)))\n", engine, ""), "9");
+	}
+	// Every script above was parsed against natives, so it can't change any more; a new registry can.
+	try {
+		natives.add({"late", {}, Type::Void, [](int, std::span<Value>) { return Value(); }});
+		expect("late add", Engine::Tree, "added", "std::logic_error");
+	}
+	catch (std::logic_error const&) {}
+	BuiltinRegistry later;
+	later.add({"late", {}, Type::Int, [](int, std::span<Value>) { return Value(int64_t(7)); }});
+	expect("new registry", Engine::VM, runScript("print(late())\n", Engine::VM, "", later), "7");
+	if (failures == 0)
+		std::cout << "embedding: ok\n";
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#include "interpreter.h"
+
+
+// Runs source once on an interpreter of its own and returns everything it printed, followed by
+// the error it failed with, if any.
+std::string runScript(std::string source, Engine engine, std::string input, BuiltinRegistry const& builtins) {
+	std::istringstream in(std::move(input));
+	std::ostringstream out;
+	Interpreter interpreter(out, in);
+	try {
+		auto program = Program::fromText(std::move(source), engine, nullptr, builtins);
+		interpreter.run(*program);
+	}
+	catch (ScriptError const& error) {
+		static char const* const kinds[] = {"error", "thrown", "exit"};
+		out << '[' << kinds[int(error.kind)] << " at " << error.line + 1 << ": " << error.what() << ']';
+	}
+	return out.str();
+}
@@ -0,0 +1,81 @@
+#!/bin/bash
+# Regression tests: builds the interpreter and checks that
+#   - every bench/*.ciktor prints the same on the tree engine and the VM, and on the VM again
+#     with a cold and then a warm program cache, and that a damaged cache file is ignored;
+#   - the program cache evicts its least recently used files beyond its bound;
+#   - every tests/*.ciktor prints its tests/*.out, stdout and stderr together, on both engines,
+#     reading tests/*.in if there is one;
+#   - tests/embedding, a host made of two source files that both include the interpreter,
+#     links and passes.
+# Usage: tests/run.sh, from anywhere. CXX selects the compiler.
+
+cd "$(dirname "$0")/.." || exit 1
+CXX=${CXX:-c++}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+export XDG_CACHE_HOME="$work/cache"
+failures=0
+
+fail() {
+	echo "FAIL: $*"
+	failures=$((failures + 1))
+}
+
+"$CXX" -std=c++20 -O2 -pthread src/main.cpp -o "$work/ciktor" || exit 1
+
+# A checksum of everything a run printed, and its exit status. bench/input.ciktor reads the input.
+run() {
+	printf '1\n2\n\n3\n' | "$work/ciktor" --threads=4 "$@" 2>&1 | cksum
+	echo "${PIPESTATUS[1]}"
+}
+
+for script in bench/*.ciktor; do
+	tree=$(run --no-cache --engine=tree "$script")
+	[ "$(run --no-cache --engine=vm "$script")" == "$tree" ] || fail "$script: the VM differs from the tree engine"
+	rm -rf "$XDG_CACHE_HOME"
+	[ "$(run --engine=vm "$script")" == "$tree" ] || fail "$script: the VM differs when compiling into the cache"
+	ls "$XDG_CACHE_HOME"/ciktor/*.ckc > /dev/null 2>&1 || fail "$script: no cache file was written"
+	[ "$(run --engine=vm "$script")" == "$tree" ] || fail "$script: the VM differs when loading from the cache"
+	for file in "$XDG_CACHE_HOME"/ciktor/*.ckc; do
+		truncate -s 100 "$file"
+	done
+	[ "$(run --engine=vm "$script")" == "$tree" ] || fail "$script: a damaged cache file was not ignored"
+done
+
+# The cache keeps the 256 most recently used programs: loading the oldest saves it from eviction.
+rm -rf "$XDG_CACHE_HOME"
+mkdir -p "$work/scripts"
+for i in $(seq 0 257); do
+	echo "print($i)" > "$work/scripts/$i.ciktor"
+done
+for i in $(seq 0 255); do
+	"$work/ciktor" --engine=vm "$work/scripts/$i.ciktor" > /dev/null
+done
+oldest=$(ls -tr "$XDG_CACHE_HOME"/ciktor/*.ckc | head -n 2)
+"$work/ciktor" --engine=vm "$work/scripts/0.ciktor" > /dev/null
+"$work/ciktor" --engine=vm "$work/scripts/256.ciktor" > /dev/null
+"$work/ciktor" --engine=vm "$work/scripts/257.ciktor" > /dev/null
+[ "$(ls "$XDG_CACHE_HOME"/ciktor/*.ckc | wc -l)" -eq 256 ] || fail "the cache grew past 256 programs"
+[ -f "$(echo "$oldest" | head -n 1)" ] || fail "the cache evicted a program just loaded"
+[ ! -f "$(echo "$oldest" | tail -n 1)" ] || fail "the cache kept its least recently used program"
+
+for script in tests/*.ciktor; do
+	input=/dev/null
+	[ -f "${script%.ciktor}.in" ] && input="${script%.ciktor}.in"
+	for engine in tree vm vm; do # the second VM run loads the first one's cache file
+		"$work/ciktor" --threads=4 --engine=$engine "$script" < "$input" > "$work/output" 2>&1
+		if ! cmp -s "$work/output" "${script%.ciktor}.out"; then
+			fail "$script on the $engine engine"
+			diff "${script%.ciktor}.out" "$work/output" | head -n 10
+		fi
+	done
+done
+
+if "$CXX" -std=c++20 -O1 -pthread -Isrc tests/embedding/*.cpp -o "$work/embedding"; then
+	"$work/embedding" > /dev/null || { fail "tests/embedding"; "$work/embedding"; }
+else
+	fail "tests/embedding does not build"
+fi
+
+[ $failures -eq 0 ] && echo "all tests passed"
+[ $failures -eq 0 ]